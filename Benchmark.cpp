@@ -0,0 +1,511 @@
+/*
+Benchmark.cpp
+
+Console application for timing the encoder. It has its own main, so it is built separately from HUFF:
+
+	g++ -std=c++20 -O2 -pthread Benchmark.cpp Huffman.cpp HNode.cpp Histogram.cpp ThreadPool.cpp Pipeline.cpp MappedFile.cpp Stats.cpp -o BENCH
+
+============MODES===========
+
+Synthetic corpora:
+
+	Syntax: BENCH [-corpus] [runs] [sizeMB]
+
+	Uses: Generates the same corpora on every run and platform (uniform random, Zipf-skewed bytes,
+	text-like words, a single repeated byte, and a pile of tiny 64-byte messages), sizeMB each (default 16).
+	Each corpus is cut into pieces (blocks, or the tiny messages) and every phase is timed on its own:
+
+		count	- counting the bytes of each piece (countBytes)
+		tree	- building each piece's huffman tree (initTree)
+		cipher	- turning each tree into canonical codes (buildCipher, limitCodeLengths, assignCanonicalCodes)
+		encode	- the whole in-memory encode
+		decode	- the whole in-memory decode
+		decode x4	- the same, for blocks split into 4 interleaved streams (-s 4)
+		encode ctx	- the whole encode with order-1 context tables (-c 16)
+		decode ctx	- the whole decode of those blocks
+		encode 1/16	- the whole encode with codes built from sampled counts (--stride 16)
+
+	Every phase is run runs times (default 5) after a warm-up, and the best and median MB/s of the
+	corpus are reported, along with the encoded size as a fraction of the original, with exact and
+	with sampled counts. The encode and decode rows also show which block types the pieces came out as:
+	stored and RLE blocks are only copied, so those rows time memcpy and memset rather than the coder.
+
+File I/O:
+
+	Syntax: BENCH file [runs]
+
+	Uses: For both streamed and memory mapped input, times a read of file, encodeFile with exact and with
+	sampled counts (--stride 16), and decodeFile on one thread and on every core. Runs are after a warm-up,
+	so file is in the page cache. The size of the file encoded with sampled counts is printed against the
+	exact one, to see what sampling costs on that data.
+
+==========================================
+
+*/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <filesystem>
+
+#include "Huffman.h"
+#include "Histogram.h"
+#include "MappedFile.h"
+
+#define BENCH_STRIDE 16 // Stride the sampled encodes use, as with --stride 16
+
+using namespace std;
+
+struct Corpus
+{
+	string name;
+	vector<unsigned char> data;
+	size_t pieceSize; // Each piece is counted, given a tree, and encoded on its own
+};
+
+class HuffmanBenchmark // Friend of Huffman, so each phase of encoding can be timed on its own
+{
+public:
+
+	static vector<double> timePhase(Huffman& coder, const Corpus& corpus, int runs, string phase, string& blocks); // Seconds taken by each run of phase over corpus, and the block types it coded
+	static size_t encodedSize(Huffman& coder, const Corpus& corpus); // Total size of every piece encoded on its own
+};
+
+vector<double> timeRuns(int runs, function<void()> task); // Runs task runs times after a warm-up, returns each time in seconds
+void report(string name, vector<double> seconds, unsigned long long bytes, string note = ""); // Prints best and median MB/s
+void countBlockTypes(const vector<unsigned char>& encoded, unsigned long long typeBytes[BLOCK_CONTEXT + 1]); // Adds the raw bytes each block type holds in an encoded buffer
+string describeBlockTypes(const unsigned long long typeBytes[BLOCK_CONTEXT + 1]); // Names the block types and their shares, like "huffman 90%, stored 10%"
+void corpusMode(int runs, size_t size); // Benchmarks every synthetic corpus
+void fileMode(string inputFile, int runs); // Compares streamed and mapped file I/O
+Corpus makeCorpus(string name, size_t size); // Generates one of the synthetic corpora
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2 || (string)argv[1] == "-corpus")
+	{
+		int runs = argc > 2 ? atoi(argv[2]) : 5;
+		size_t sizeMB = argc > 3 ? atoi(argv[3]) : 16;
+		corpusMode(max(runs, 1), max(sizeMB, (size_t)1) << 20);
+	}
+	else
+	{
+		int runs = argc > 2 ? atoi(argv[2]) : 5;
+		fileMode(argv[1], max(runs, 1));
+	}
+
+	return 0;
+}
+
+unsigned long long nextRandom(unsigned long long& state)
+{
+	/*
+	* splitmix64. Written out here, instead of using <random>'s distributions, since those are allowed to
+	* give different numbers on different standard libraries, and the corpora need to be the same everywhere.
+	*/
+
+	unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+double nextUnit(unsigned long long& state) // Random double in [0, 1)
+{
+	return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+size_t pickZipf(const vector<double>& cdf, unsigned long long& state) // Index picked with the weights cdf[] adds up
+{
+	return min((size_t)(lower_bound(cdf.begin(), cdf.end(), nextUnit(state)) - cdf.begin()), cdf.size() - 1);
+}
+
+vector<double> zipfCdf(size_t count, double exponent) // Cumulative weights of 1 / rank^exponent
+{
+	vector<double> cdf(count);
+	double total = 0;
+	for (size_t i = 0; i < count; i++) cdf[i] = total += 1.0 / pow(i + 1.0, exponent);
+	for (size_t i = 0; i < count; i++) cdf[i] /= total;
+	return cdf;
+}
+
+Corpus makeCorpus(string name, size_t size)
+{
+	Corpus corpus = { name, vector<unsigned char>(size), DEFAULT_BLOCK_SIZE };
+	unsigned long long state = 2510; // Same seed every run
+
+	if (name == "uniform")
+	{
+		for (size_t i = 0; i < size; i++) corpus.data[i] = (unsigned char)nextRandom(state);
+	}
+	else if (name == "zipf") // Byte ranks weighted 1 / rank^1.1, shuffled so the common bytes aren't just the low ones
+	{
+		unsigned char order[256];
+		for (int i = 0; i < 256; i++) order[i] = i;
+		for (int i = 255; i > 0; i--) swap(order[i], order[nextRandom(state) % (i + 1)]);
+
+		vector<double> cdf = zipfCdf(256, 1.1);
+		for (size_t i = 0; i < size; i++) corpus.data[i] = order[pickZipf(cdf, state)];
+	}
+	else if (name == "text") // Words from a 4096 word vocabulary, picked with Zipf weights, with spaces, punctuation and lines
+	{
+		vector<string> words(4096);
+		vector<double> letters = zipfCdf(26, 0.9);
+		for (string& word : words)
+		{
+			size_t length = 1 + nextRandom(state) % 9;
+			for (size_t i = 0; i < length; i++) word += (char)('a' + pickZipf(letters, state));
+		}
+
+		vector<double> cdf = zipfCdf(words.size(), 1.0);
+		size_t filled = 0;
+		size_t line = 0;
+
+		while (filled < size)
+		{
+			string word = words[pickZipf(cdf, state)];
+			unsigned long long roll = nextRandom(state) % 100;
+
+			if (line == 0 && !word.empty()) word[0] -= 'a' - 'A'; // Capitalize the start of a line
+			if (roll < 6) word += ',';
+			else if (roll < 9) word += '.';
+
+			line += word.size() + 1;
+			word += line > 72 ? '\n' : ' ';
+			if (line > 72) line = 0;
+
+			for (size_t i = 0; i < word.size() && filled < size; i++) corpus.data[filled++] = word[i];
+		}
+	}
+	else if (name == "one-byte")
+	{
+		fill(corpus.data.begin(), corpus.data.end(), 'a');
+	}
+	else if (name == "tiny") // Short text-like messages, each encoded on its own
+	{
+		corpus = makeCorpus("text", size);
+		corpus.name = name;
+		corpus.pieceSize = 64;
+	}
+
+	return corpus;
+}
+
+vector<double> HuffmanBenchmark::timePhase(Huffman& coder, const Corpus& corpus, int runs, string phase, string& blocks)
+{
+	/*
+	* The tree and cipher phases need each piece's counts first, so those are worked out once up front and
+	* copied in before each piece, and only the phase itself is timed. Decode needs each piece encoded first,
+	* which is also done up front.
+	*
+	* For the phases that encode or decode, blocks is set to the block types the pieces were encoded as
+	* (counted from the pieces encoded up front, or in the warm-up run), and left empty for the others.
+	*/
+
+	size_t pieces = (corpus.data.size() + corpus.pieceSize - 1) / corpus.pieceSize;
+	vector<unsigned long long> counts(pieces * 256, 0);
+
+	for (size_t i = 0; i < pieces; i++)
+	{
+		size_t start = i * corpus.pieceSize;
+		countBytes(corpus.data.data() + start, min(corpus.pieceSize, corpus.data.size() - start), &counts[i * 256]);
+	}
+
+	vector<unsigned char> encoded; // Every piece's encoded buffer, back to back
+	vector<size_t> encodedStart; // Where each one starts in encoded
+	vector<unsigned char> scratch;
+	unsigned long long typeBytes[BLOCK_CONTEXT + 1] = { 0 }; // Raw bytes coded as each block type
+
+	coder.setBlockSize(corpus.pieceSize);
+	bool decoding = phase == "decode" || phase == "decode x4" || phase == "decode ctx";
+	coder.setStreams(phase == "decode x4" ? BLOCK_STREAMS : 1);
+	coder.setContextTables(phase == "encode ctx" || phase == "decode ctx" ? CONTEXT_MAX_TABLES : 0);
+	bool sampling = phase == "encode 1/" + to_string(BENCH_STRIDE);
+	coder.setHistogramStride(sampling ? BENCH_STRIDE : 1);
+
+	for (size_t i = 0; i < pieces && decoding; i++)
+	{
+		size_t start = i * corpus.pieceSize;
+		coder.encode(span<const unsigned char>(corpus.data.data() + start, min(corpus.pieceSize, corpus.data.size() - start)), scratch);
+		countBlockTypes(scratch, typeBytes);
+		encodedStart.push_back(encoded.size());
+		encoded.insert(encoded.end(), scratch.begin(), scratch.end());
+	}
+	encodedStart.push_back(encoded.size());
+
+	vector<double> seconds;
+
+	for (int run = 0; run <= runs; run++) // Run 0 is the warm-up
+	{
+		double phaseSeconds = 0;
+		auto runStart = chrono::steady_clock::now();
+
+		for (size_t i = 0; i < pieces; i++)
+		{
+			size_t start = i * corpus.pieceSize;
+			size_t length = min(corpus.pieceSize, corpus.data.size() - start);
+			const unsigned char* piece = corpus.data.data() + start;
+
+			if (phase == "count")
+			{
+				fill_n(coder.charCounts, 256, 0);
+				countBytes(piece, length, coder.charCounts);
+			}
+			else if (phase == "tree" || phase == "cipher")
+			{
+				copy(&counts[i * 256], &counts[i * 256] + 256, coder.charCounts);
+				coder.symbolCount = length;
+
+				auto begin = chrono::steady_clock::now();
+				coder.initTree();
+
+				if (phase == "cipher") // Tree isn't part of this phase, start the clock over
+				{
+					begin = chrono::steady_clock::now();
+					coder.buildCipher();
+					coder.limitCodeLengths(min(coder.maxCodeLength, BLOCK_MAX_CODE_LENGTH));
+					coder.assignCanonicalCodes();
+				}
+
+				phaseSeconds += chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+			}
+			else if (phase == "encode" || phase == "encode ctx" || sampling)
+			{
+				coder.encode(span<const unsigned char>(piece, length), scratch);
+				if (run == 0) countBlockTypes(scratch, typeBytes);
+			}
+			else if (decoding)
+			{
+				coder.decode(span<const unsigned char>(encoded.data() + encodedStart[i], encodedStart[i + 1] - encodedStart[i]), scratch);
+			}
+		}
+
+		if (phase != "tree" && phase != "cipher") phaseSeconds = chrono::duration<double>(chrono::steady_clock::now() - runStart).count();
+		if (run > 0) seconds.push_back(phaseSeconds);
+	}
+
+	coder.setStreams(1);
+	coder.setContextTables(0);
+	coder.setHistogramStride(1);
+
+	blocks = describeBlockTypes(typeBytes);
+
+	return seconds;
+}
+
+size_t HuffmanBenchmark::encodedSize(Huffman& coder, const Corpus& corpus)
+{
+	size_t total = 0;
+	vector<unsigned char> scratch;
+	coder.setBlockSize(corpus.pieceSize);
+
+	for (size_t start = 0; start < corpus.data.size(); start += corpus.pieceSize)
+	{
+		coder.encode(span<const unsigned char>(corpus.data.data() + start, min(corpus.pieceSize, corpus.data.size() - start)), scratch);
+		total += scratch.size();
+	}
+
+	return total;
+}
+
+void corpusMode(int runs, size_t size)
+{
+	string names[] = { "uniform", "zipf", "text", "one-byte", "tiny" };
+	string phases[] = { "count", "tree", "cipher", "encode", "decode", "decode x4", "encode ctx", "decode ctx", "encode 1/" + to_string(BENCH_STRIDE) };
+
+	cout << "Best and median of " << runs << " runs, MB/s of the original corpus" << endl;
+
+	for (string name : names)
+	{
+		Corpus corpus = makeCorpus(name, name == "tiny" ? min(size, (size_t)1 << 20) : size); // Tiny messages are slow per byte, keep the run short
+		Huffman coder;
+
+		size_t encoded = HuffmanBenchmark::encodedSize(coder, corpus);
+		coder.setHistogramStride(BENCH_STRIDE);
+		size_t sampled = HuffmanBenchmark::encodedSize(coder, corpus);
+		coder.setHistogramStride(1);
+
+		cout << name << ": " << corpus.data.size() << " bytes in " << corpus.pieceSize << "-byte pieces, encoded to "
+			<< fixed << setprecision(3) << (double)encoded / corpus.data.size() << " of the size ("
+			<< (double)sampled / corpus.data.size() << " from sampled counts)" << endl;
+
+		for (string phase : phases)
+		{
+			string blocks;
+			vector<double> seconds = HuffmanBenchmark::timePhase(coder, corpus, runs, phase, blocks);
+			report(phase, seconds, corpus.data.size(), blocks);
+		}
+	}
+}
+
+void fileMode(string inputFile, int runs)
+{
+	string encodedFile = inputFile + ".bench.huf";
+	string decodedFile = inputFile + ".bench.out";
+	int cores = thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 1;
+
+	unsigned long long bytes = 0;
+	{
+		FileReader reader(1 << 20, false);
+		if (!reader.open(inputFile))
+		{
+			cout << "Unable to open file: " << inputFile << endl;
+			exit(0);
+		}
+
+		unsigned char* buffer = new unsigned char[1 << 20];
+		const unsigned char* chunk;
+		size_t length;
+		while ((length = reader.next(chunk, buffer)) > 0) bytes += length;
+		delete[] buffer;
+	}
+
+	cout << inputFile << ": " << bytes << " bytes, best and median of " << runs << " runs" << endl;
+
+	for (int mapped = 0; mapped < 2; mapped++)
+	{
+		cout << (mapped ? "mapped:" : "streamed:") << endl;
+
+		report("read", timeRuns(runs, [&]()
+		{
+			FileReader reader(1 << 20, mapped);
+			reader.open(inputFile);
+
+			unsigned char* buffer = new unsigned char[1 << 20];
+			unsigned long long counts[256] = { 0 };
+			const unsigned char* chunk;
+			size_t length;
+			while ((length = reader.next(chunk, buffer)) > 0) countBytes(chunk, length, counts);
+			delete[] buffer;
+		}), bytes);
+
+		stringstream quiet; // Huffman prints a line per file, which would bury the results
+		streambuf* console = cout.rdbuf(quiet.rdbuf());
+
+		vector<double> encodeSampled = timeRuns(runs, [&]()
+		{
+			Huffman coder;
+			coder.setMemoryMapping(mapped);
+			coder.setHistogramStride(BENCH_STRIDE);
+			coder.encodeFile(inputFile, encodedFile);
+		});
+
+		unsigned long long sampledSize = filesystem::file_size(encodedFile);
+
+		vector<double> encode = timeRuns(runs, [&]()
+		{
+			Huffman coder;
+			coder.setMemoryMapping(mapped);
+			coder.encodeFile(inputFile, encodedFile);
+		});
+
+		unsigned long long exactSize = filesystem::file_size(encodedFile);
+		vector<double> decode = timeRuns(runs, [&]()
+		{
+			Huffman coder;
+			coder.setMemoryMapping(mapped);
+			coder.decodeFile(encodedFile, decodedFile);
+		});
+
+		vector<double> decodeParallel = timeRuns(runs, [&]()
+		{
+			Huffman coder;
+			coder.setMemoryMapping(mapped);
+			coder.setThreads(cores);
+			coder.decodeFile(encodedFile, decodedFile);
+		});
+
+		cout.rdbuf(console);
+
+		report("encode", encode, bytes);
+		report("encode 1/" + to_string(BENCH_STRIDE), encodeSampled, bytes);
+		report("decode", decode, bytes);
+		report("decode -j " + to_string(cores), decodeParallel, bytes);
+
+		cout << "\tsampled counts (--stride " << BENCH_STRIDE << "): " << sampledSize << " bytes vs " << exactSize << " exact (+"
+			<< fixed << setprecision(3) << 100.0 * ((double)sampledSize - exactSize) / max(exactSize, 1ULL) << "%)" << endl;
+	}
+
+	remove(encodedFile.c_str());
+	remove(decodedFile.c_str());
+}
+
+vector<double> timeRuns(int runs, function<void()> task)
+{
+	vector<double> seconds;
+
+	for (int i = 0; i <= runs; i++) // Run 0 is the warm-up
+	{
+		auto start = chrono::steady_clock::now();
+		task();
+		double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		if (i > 0) seconds.push_back(elapsed);
+	}
+
+	return seconds;
+}
+
+void report(string name, vector<double> seconds, unsigned long long bytes, string note)
+{
+	sort(seconds.begin(), seconds.end());
+	double best = seconds.front();
+	double median = seconds.size() % 2 ? seconds[seconds.size() / 2] : (seconds[seconds.size() / 2 - 1] + seconds[seconds.size() / 2]) / 2;
+
+	cout << "\t" << left << setw(12) << name << right << fixed << setprecision(1)
+		<< setw(12) << bytes / best / 1e6 << " MB/s best" << setw(12) << bytes / median / 1e6 << " MB/s median"
+		<< (note != "" ? "   (" + note + ")" : "") << endl;
+}
+
+void countBlockTypes(const vector<unsigned char>& encoded, unsigned long long typeBytes[BLOCK_CONTEXT + 1])
+{
+	/*
+	* Walks the block records of an encoded buffer, from after its 7-byte header to the empty record that
+	* ends them, adding each record's raw length to its type's count.
+	*/
+
+	size_t offset = 7;
+
+	while (offset + BLOCK_HEADER_SIZE <= encoded.size())
+	{
+		const unsigned char* record = encoded.data() + offset;
+		unsigned long long rawLength = 0;
+		unsigned long long payloadLength = 0;
+
+		for (int i = 0; i < 4; i++)
+		{
+			rawLength |= (unsigned long long)record[i] << (8 * i);
+			payloadLength |= (unsigned long long)record[5 + i] << (8 * i);
+		}
+
+		if (rawLength == 0 || record[4] > BLOCK_CONTEXT) break;
+
+		typeBytes[record[4]] += rawLength;
+		offset += BLOCK_HEADER_SIZE + payloadLength;
+	}
+}
+
+string describeBlockTypes(const unsigned long long typeBytes[BLOCK_CONTEXT + 1])
+{
+	string names[BLOCK_CONTEXT + 1] = { "huffman", "huffman x4", "stored", "rle", "context" };
+	unsigned long long total = 0;
+	for (int i = 0; i <= BLOCK_CONTEXT; i++) total += typeBytes[i];
+
+	string description;
+
+	for (int i = 0; i <= BLOCK_CONTEXT; i++)
+	{
+		if (typeBytes[i] == 0) continue;
+		if (description != "") description += ", ";
+		description += names[i];
+		if (typeBytes[i] < total) description += " " + to_string((int)round(100.0 * typeBytes[i] / total)) + "%";
+	}
+
+	return description;
+}
@@ -0,0 +1,97 @@
+/*
+BitIO.h
+
+A bit writer shared by every encoder in the project, and the matching reader used by the block decoders.
+
+Kept in a header so put() and refill() can be inlined into the coding loops.
+
+*/
+
+#pragma once
+
+struct BitWriter
+{
+	/*
+	* Codes are shifted into a 64-bit buffer from the right, so the oldest bits are the highest.
+	* Whenever 32 bits have built up, they are stored to out as a big-endian word.
+	*
+	* IMPORTANT: out must have room for every byte that will be written, put() doesn't check.
+	*/
+
+	unsigned long long buffer = 0; // Bits waiting to be written
+	int count = 0; // Number of bits in buffer (always under 32 between calls)
+	unsigned char* out = nullptr; // Where the next word goes
+
+	inline void put(unsigned int code, int length) // Adds a right-aligned code of up to 32 bits
+	{
+		buffer = (buffer << length) | code;
+		count += length;
+
+		if (count >= 32)
+		{
+			count -= 32;
+			unsigned int word = (unsigned int)(buffer >> count);
+			out[0] = word >> 24;
+			out[1] = word >> 16;
+			out[2] = word >> 8;
+			out[3] = word;
+			out += 4;
+		}
+	}
+
+	inline void putLong(const unsigned long long code[4], int length) // Adds a left-aligned code of up to 256 bits, 32 bits at a time
+	{
+		for (int pos = 0; pos < length; pos += 32)
+		{
+			unsigned int chunk = (unsigned int)(code[pos / 64] >> (32 - pos % 64)); // 32 bits starting at pos
+			int chunkLength = length - pos < 32 ? length - pos : 32;
+			put(chunk >> (32 - chunkLength), chunkLength);
+		}
+	}
+
+	inline void finish() // Writes out the bits that are left. If they don't fill the last byte, it is padded with 0s
+	{
+		while (count > 0)
+		{
+			count -= 8;
+			*(out++) = (unsigned char)(count >= 0 ? buffer >> count : buffer << -count);
+		}
+		count = 0;
+	}
+};
+
+struct BitReader
+{
+	/*
+	* Reads a stream written by BitWriter from memory. Upcoming bits are kept left-aligned in a 64-bit
+	* buffer, so the next code is always buffer >> (64 - length). Past the end of the stream, the buffer
+	* fills with 0s.
+	*/
+
+	const unsigned char* in = nullptr; // Next byte to load
+	const unsigned char* end = nullptr; // End of the stream
+	unsigned long long buffer = 0; // Upcoming bits, left-aligned
+	int count = 0; // Number of valid bits in buffer
+
+	inline void refillFast() // Tops buffer up to at least 56 bits. Needs 8 bytes left before end
+	{
+		unsigned long long word = 0;
+		for (int i = 0; i < 8; i++) word = (word << 8) | in[i]; // load 8 bytes big-endian and keep as many whole bytes as fit
+		buffer |= word >> count;
+		in += (63 - count) >> 3;
+		count |= 56;
+	}
+
+	inline void refill() // Tops buffer up with as many bits as fit, or as are left
+	{
+		if (end - in >= 8) refillFast();
+		else // Near the end of the bits, refill byte-by-byte
+		{
+			while (count <= 56 && in < end)
+			{
+				buffer |= (unsigned long long)*(in++) << (56 - count);
+				count += 8;
+			}
+		}
+	}
+};
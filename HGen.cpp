@@ -0,0 +1,179 @@
+/*
+HGen.cpp
+
+Console application that bakes a tree building file into a C++ header, for StaticCodec.h. It has its own
+main, so it is built separately from HUFF:
+
+	g++ -std=c++20 -O2 -pthread HGen.cpp Huffman.cpp HNode.cpp Histogram.cpp ThreadPool.cpp Pipeline.cpp MappedFile.cpp Stats.cpp -o HGEN
+
+============MODES===========
+
+Generate a header:
+
+	Syntax: HGEN file1 [file2] [name]
+
+	Uses: Rebuilds the tree in the 510-byte tree building file file1 (made by HUFF -t), the same way -et does,
+	and writes its codes and decode tables to the header file2 as "inline constexpr StaticTable name".
+	If file2 is omitted, it is file1 with a .h extension. If name is omitted, it is file2's name
+	(without the extension), with anything that can't go in an identifier replaced by _.
+
+	Including the header and using StaticCodec<name> then encodes and decodes with that tree, with no
+	setup at run time.
+
+==========================================
+
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <filesystem>
+
+#include "Huffman.h"
+
+using namespace std;
+
+class HuffmanGenerator // Friend of Huffman, so the tree can be rebuilt and compiled with the same code -et uses
+{
+public:
+
+	static void writeHeader(string treeFile, string outputFile, string name); // Writes treeFile's tables to outputFile
+};
+
+string identifierFor(string name); // Turns name into a valid C++ identifier
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2 || (string)argv[1] == "-h" || (string)argv[1] == "-?" || (string)argv[1] == "-help")
+	{
+		cout << "GENERATE A STATIC CODEC HEADER: file1 [file2] [name]" << endl;
+		return 0;
+	}
+
+	string treeFile = argv[1];
+	string outputFile = argc > 2 ? argv[2] : "";
+
+	if (outputFile == "") // If outputFile is not specified, set its name to the tree file w/ extension .h
+	{
+		size_t last = treeFile.find_last_of('.');
+		outputFile = treeFile.substr(0, last) + ".h";
+	}
+
+	string name = argc > 3 ? argv[3] : filesystem::path(outputFile).stem().string();
+
+	HuffmanGenerator::writeHeader(treeFile, outputFile, identifierFor(name));
+
+	return 0;
+}
+
+void HuffmanGenerator::writeHeader(string treeFile, string outputFile, string name)
+{
+	/*
+	* Rebuilds treeFile's tree with rebuildPairOrder and rebuildTree, gives out its codes with buildCipher and
+	* compiles its decode tables with compileDecoder, exactly as encodeFileWithTree and decodeFile do. Then
+	* every array is printed out as the initializer of a StaticTable.
+	*
+	* Codes of up to 64 bits only need their first word printed, the rest are left to be zero-initialized.
+	*/
+
+	Huffman* coder = new Huffman();
+
+	coder->rebuildPairOrder(treeFile);
+	if (!coder->rebuildTree(treeFile)) exit(1);
+	coder->buildCipher();
+	coder->compileDecoder();
+
+	int maxLength = 0;
+	for (int i = 0; i < 256; i++) maxLength = max(maxLength, (int)coder->cipherLength[i]);
+
+	ofstream output(outputFile);
+
+	if (!output.is_open())
+	{
+		cout << "Unable to open file: " << outputFile << endl;
+		exit(0);
+	}
+
+	output << "/*" << endl;
+	output << "Generated by HGEN from " << filesystem::path(treeFile).filename().string() << ". Rerun HGEN instead of editing it." << endl;
+	output << endl;
+	output << "Use with StaticCodec<" << name << ">. Longest code: " << maxLength << " bits." << endl;
+	output << "*/" << endl;
+	output << endl;
+	output << "#include \"StaticCodec.h\"" << endl;
+	output << "#pragma once" << endl;
+	output << endl;
+	output << "inline constexpr StaticTable " << name << " =" << endl;
+	output << "{" << endl;
+	output << "\t" << maxLength << "," << endl;
+
+	output << "\t{ // codes" << endl << hex;
+	for (int i = 0; i < 256; i++)
+	{
+		unsigned long long code[4] = { 0, 0, 0, 0 }; // Left-aligned, like longCipher[]
+		int length = coder->cipherLength[i];
+
+		if (length <= 32) code[0] = (unsigned long long)coder->cipherCode[i] << (64 - length);
+		else for (int j = 0; j < 4; j++) code[j] = coder->longCipher[i][j];
+
+		for (int j = 0; j < 4; j++) // Clear the bits past the end of the code, buildCipher leaves other paths' bits there
+		{
+			int keep = min(max(length - 64 * j, 0), 64);
+			code[j] = keep == 0 ? 0 : keep == 64 ? code[j] : code[j] & ~(~0ULL >> keep);
+		}
+
+		int words = length <= 64 ? 1 : (length + 63) / 64;
+
+		output << "\t\t{ ";
+		for (int j = 0; j < words; j++) output << "0x" << code[j] << "ULL" << (j + 1 < words ? ", " : "");
+		output << " }," << endl;
+	}
+	output << dec << "\t}," << endl;
+
+	output << "\t{ // lengths" << endl;
+	for (int i = 0; i < 256; i += 16)
+	{
+		output << "\t\t";
+		for (int j = i; j < i + 16; j++) output << (int)coder->cipherLength[j] << ",";
+		output << endl;
+	}
+	output << "\t}," << endl;
+
+	output << "\t{ // decode" << endl;
+	for (int i = 0; i < (1 << DECODE_BITS); i += 8)
+	{
+		output << "\t\t";
+		for (int j = i; j < i + 8; j++) output << "{ " << coder->decodeTable[j].symbol << ", " << (int)coder->decodeTable[j].length << " },";
+		output << endl;
+	}
+	output << "\t}," << endl;
+
+	output << "\t{ // nodes" << endl;
+	for (int i = 0; i < 255; i += 8)
+	{
+		output << "\t\t";
+		for (int j = i; j < i + 8 && j < 255; j++) output << "{ " << coder->decodeNodes[j][0] << ", " << coder->decodeNodes[j][1] << " },";
+		output << endl;
+	}
+	output << "\t}" << endl;
+
+	output << "};" << endl;
+	output.close();
+
+	cout << "Wrote " << name << " to " << outputFile << " (longest code " << maxLength << " bits)" << endl;
+
+	delete coder;
+}
+
+string identifierFor(string name)
+{
+	/*
+	* Replaces anything that isn't a letter, digit or _ with _, and starts the name with _ if it would
+	* otherwise start with a digit.
+	*/
+
+	for (char& c : name) if (!isalnum((unsigned char)c) && c != '_') c = '_';
+	if (name == "" || isdigit((unsigned char)name[0])) name = "_" + name;
+
+	return name;
+}
@@ -8,9 +8,10 @@ HNode.h
 
 A simple node struct.
 
-Has a key contianing a string, a weight, and 2 pointers.
+Has a key contianing a byte, a weight, and the indices of 2 children.
 
-To be used in huffman tree
+To be used in huffman tree. Nodes live in a flat array, so children are
+referred to by their index in it instead of by pointer.
 
 */
 
@@ -21,9 +22,9 @@ struct HNode
 
 	unsigned char key; // Byte carried by node
 
-	HNode* lPtr; // left and right pointers
-	HNode* rPtr;
+	short left; // left and right children, -1 if node is a leaf
+	short right;
 
-	unsigned int weight; // weight of the node
+	unsigned long long weight; // weight of the node
 
 };
\ No newline at end of file
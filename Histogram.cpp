@@ -0,0 +1,133 @@
+/*
+Histogram.cpp
+
+Counts how many times each byte value appears in a buffer.
+
+A single count table stalls on runs of the same byte, since every increment has to wait for the
+previous one to the same counter to finish. Spreading consecutive bytes over HISTOGRAM_TABLES
+separate tables lets those increments overlap, and the tables are summed at the end.
+
+sampleBytes counts only part of a buffer, for an estimate of its counts in a fraction of the time.
+
+*/
+
+#include "Histogram.h"
+#include <cstring>
+#include <algorithm>
+
+#define HISTOGRAM_CHUNK (1 << 30) // Most bytes counted before the 32-bit tables are emptied into counts[]
+
+using namespace std;
+
+static void countInto(unsigned int tables[HISTOGRAM_TABLES][256], const unsigned char* data, size_t length)
+{
+	/*
+	* Adds the bytes of data to the interleaved tables, reading 16 bytes at a time as two 64-bit words and
+	* sending each byte to the next table.
+	*/
+
+	const unsigned char* p = data;
+	const unsigned char* end = data + (length & ~(size_t)15);
+
+	while (p < end)
+	{
+		unsigned long long a, b;
+		memcpy(&a, p, 8);
+		memcpy(&b, p + 8, 8);
+		p += 16;
+
+		tables[0][a & 0xFF]++;
+		tables[1][(a >> 8) & 0xFF]++;
+		tables[2][(a >> 16) & 0xFF]++;
+		tables[3][(a >> 24) & 0xFF]++;
+		tables[0][(a >> 32) & 0xFF]++;
+		tables[1][(a >> 40) & 0xFF]++;
+		tables[2][(a >> 48) & 0xFF]++;
+		tables[3][a >> 56]++;
+
+		tables[0][b & 0xFF]++;
+		tables[1][(b >> 8) & 0xFF]++;
+		tables[2][(b >> 16) & 0xFF]++;
+		tables[3][(b >> 24) & 0xFF]++;
+		tables[0][(b >> 32) & 0xFF]++;
+		tables[1][(b >> 40) & 0xFF]++;
+		tables[2][(b >> 48) & 0xFF]++;
+		tables[3][b >> 56]++;
+	}
+
+	end = data + length;
+	while (p < end) tables[0][*(p++)]++; // Leftover bytes that don't make a whole 16
+}
+
+static void emptyTables(unsigned int tables[HISTOGRAM_TABLES][256], unsigned long long counts[256])
+{
+	/*
+	* Sums the interleaved tables into counts[] and clears them.
+	*/
+
+	for (int i = 0; i < 256; i++) counts[i] += (unsigned long long)tables[0][i] + tables[1][i] + tables[2][i] + tables[3][i];
+	memset(tables, 0, sizeof(unsigned int) * HISTOGRAM_TABLES * 256);
+}
+
+void countBytes(const unsigned char* data, size_t length, unsigned long long counts[256])
+{
+	/*
+	* Adds the number of times each byte appears in data to counts[].
+	*
+	* Chunks of at most HISTOGRAM_CHUNK bytes are counted at a time, so the 32-bit table entries
+	* can never overflow.
+	*/
+
+	unsigned int tables[HISTOGRAM_TABLES][256];
+	memset(tables, 0, sizeof(tables));
+
+	while (length > 0)
+	{
+		size_t chunk = min(length, (size_t)HISTOGRAM_CHUNK);
+		countInto(tables, data, chunk);
+		emptyTables(tables, counts);
+
+		data += chunk;
+		length -= chunk;
+	}
+}
+
+size_t sampleBytes(const unsigned char* data, size_t length, size_t stride, unsigned long long counts[256])
+{
+	/*
+	* Adds the counts of a strided sample of data to counts[]: the first HISTOGRAM_SAMPLE_RUN bytes, then
+	* the run stride runs after that, and so on. Returns the number of bytes counted, about length / stride.
+	*
+	* Whole runs are counted instead of single bytes, since memory is read a cache line at a time anyway.
+	* Spreading the runs over all of data catches changes across it that counting one piece would miss,
+	* but a byte that only turns up in the runs that were skipped gets a count of 0. Scaling the counts up
+	* and giving those bytes a weight is left to the caller.
+	*/
+
+	unsigned int tables[HISTOGRAM_TABLES][256];
+	memset(tables, 0, sizeof(tables));
+
+	size_t step = max(stride, (size_t)1) * HISTOGRAM_SAMPLE_RUN;
+	size_t sampled = 0;
+	size_t pending = 0; // Bytes in the tables, emptied before they can overflow
+
+	for (size_t start = 0; start < length; start += step)
+	{
+		size_t run = min((size_t)HISTOGRAM_SAMPLE_RUN, length - start);
+		countInto(tables, data + start, run);
+		sampled += run;
+		pending += run;
+
+		if (pending >= HISTOGRAM_CHUNK)
+		{
+			emptyTables(tables, counts);
+			pending = 0;
+		}
+
+		if (length - start <= step) break; // The next run would start past the end (or wrap around)
+	}
+
+	emptyTables(tables, counts);
+
+	return sampled;
+}
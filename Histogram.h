@@ -0,0 +1,23 @@
+/*
+Histogram.h
+
+Byte counting used to get the weights a huffman tree is built from.
+
+Kept separate from the Huffman class (and HNode) so anything that needs a
+frequency count of a buffer can use it.
+
+*/
+
+#include <cstddef>
+#pragma once
+
+#define HISTOGRAM_TABLES 4 // Number of interleaved count tables used by countBytes
+#define HISTOGRAM_SAMPLE_RUN 64 // Bytes in each run sampleBytes counts, one cache line
+
+struct alignas(64) ByteCounts // One thread's counts. Starts on a cache line of its own, so threads counting side by side never write to the same line
+{
+	unsigned long long counts[256] = { 0 };
+};
+
+void countBytes(const unsigned char* data, size_t length, unsigned long long counts[256]); // Adds the number of times each byte appears in data to counts[]
+size_t sampleBytes(const unsigned char* data, size_t length, size_t stride, unsigned long long counts[256]); // Adds the counts of every stride-th run of data to counts[], returns the bytes counted
@@ -20,10 +20,12 @@ Huffman.encodeFile(string inputFile, string outputFile)
 	- When called, encodes inputFile into outputFile
 	- outputFile takes up less disk space than inputFile
 	- the output can later be decoded by this class
+	- Canonical codes are used, so the header only needs to store the code length of each byte that appears
 
 Huffman.decodeFile(string inputFile, string outputFile)
 
-	- Builds a tree based off of the header of inputFile, and uses it to decode inputFile
+	- Builds a decode table based off of the header of inputFile, and uses it to decode inputFile
+	- Reads both canonical files and legacy files starting with a 510-byte tree header
 	- The user is able to specify the file extension of outputFile
 	- Note that inputFile MUST have been encoded using the same algorithm present in this class to work
 
@@ -42,57 +44,72 @@ Huffman.encodeFileWithTree(string inputFile, string treeFile, string outputFile)
 */
 
 #include "Huffman.h"
+#include "Histogram.h"
+#include "ThreadPool.h"
+#include "Pipeline.h"
+#include "MappedFile.h"
 #include <iostream>
 #include <fstream>
 #include <chrono>
 #include <iomanip>
-#include "SimpleQueue.h"
+#include <climits>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <atomic>
+#include <cmath>
 
-#define BUFF_SIZE 1024 // Size of the buffer arrays that will be used to limit r/w operations (Make power of 2)
+#define CODER_BUFF_SIZE (1 << 18) // Size of the chunks read by writeCodeToFile and decodeFile
 
 using namespace std;
 
 Huffman::Huffman() // Constructor
 {
-	for (int i = 0; i < 256; i++) // Set all leaf values
-	{
-		unsigned char c = i;
-		leaves[i] = new HNode;
-		leaves[i]->key = c;
-		leaves[i]->rPtr = nullptr;
-		leaves[i]->lPtr = nullptr;
-		leaves[i]->weight = 0;
-	}
-
 	fill_n(pairOrder, 510, 0); // Clear pairOrder array
 
-	fill_n(charCipher, 256, 0); // Clear pairOrder array
-
-	root = nullptr;
+	fill_n(cipherCode, 256, 0); // Clear cipher arrays
+	fill_n(cipherLength, 256, 0);
+	fill_n(codeLengths, 256, 0);
+	fill_n(charCounts, 256, 0);
+
+	symbolCount = 0;
+	maxCodeLength = MAX_CODE_LENGTH;
+	blockSize = DEFAULT_BLOCK_SIZE;
+	fileBlockSize = DEFAULT_BLOCK_SIZE;
+	threads = 1;
+	useMapping = true;
+	jsonStats = false;
+	quiet = false;
+	pipelined = thread::hardware_concurrency() > 1; // Overlapping I/O with coding only pays with a core to spare for it
+	streams = 1;
+	contextTables = 0;
+	histogramStride = 1;
+	fill_n(contextMap, 256, 0);
+	unlimitedBits = 0;
+	limitedBits = 0;
+
+	nodeCount = 0;
+	root = -1;
 
 }
 
 Huffman::~Huffman() // Destructor
 {
-	tearDown(root); // Tears down the tree starting from the root
+	// The tree lives in nodes[], so there is nothing to tear down
 }
 
-void Huffman::encodeFile(string inputFile, string outputFile)
+HuffmanStatus Huffman::encodeFile(string inputFile, string outputFile)
 {
 	/* [Public Method]
 	* Encodes inputFile.
 	* 
-	* First, the method passes the input file to countChar to get the frequency count array of each character prepared.
-	* 
-	* Next, the method calls initTree to build the huffman tree, passing the input file down. Using this tree, it calls buildCipher
-	* to get the encoded equivilants of each character into the cipher array before writing to the file.
-	* 
-	* Finally, writeCodeToFile is called, passing inputFile and outputFile. This parses through the input file again, converting each
-	* byte in the file to the proper encoded bit string.
+	* inputFile is read through a FileReader, so when it can be memory mapped each block is encoded straight
+	* from the page cache without being copied. encodeBlocks does the encoding, then report prints the
+	* elapsed time and bytes in/out.
 	* 
+	* Returns HUFFMAN_NO_FILE if inputFile can't be opened, otherwise HUFFMAN_OK.
 	*/
 	
-	// Its ugly to have this here, but needed as the output file name is proccessed in writeCodeToFile()
 	if (outputFile == "") // If outputFile is not specified, set its name to the input file w/ extension .huf
 	{
 		size_t last = inputFile.find_last_of('.');
@@ -105,568 +122,3543 @@ void Huffman::encodeFile(string inputFile, string outputFile)
 	}
 
 	auto start = std::chrono::steady_clock::now(); // Used to get total elapsed time
+	stats = HuffmanStats();
 
-	countChar(inputFile); // Update char weights
-	initTree(inputFile); // Builds tree based on char weights
-	buildCipher(); // Builds the cipher array so the program can know how to encode each letter
-	writeCodeToFile(inputFile, outputFile); // uses the tree and cipher array to encode inputFile
-
-	auto end = std::chrono::steady_clock::now();
+	FileReader input(blockSize, useMapping);
 
-	ifstream bytesIn(inputFile, ios::binary | ios::ate); // Finally, output elapsed time and bytes in/out to console
-	ifstream bytesOut(outputFile, ios::binary | ios::ate);
+	if (!input.open(inputFile))
+	{
+		cout << "Unable to open file: " << inputFile << endl; // File does not exist, so alert the user
+		return HUFFMAN_NO_FILE;
+	}
 
-	double totalMs = (std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()); // gets the total number of elapsed milliseconds and divides it by 1000
+	ofstream output(outputFile, ios::binary);
 
-	double seconds = totalMs / 1000; // Divide that number by 1000 to get total elapsed seconds
+	encodeBlocks(input, output);
+	output.close();
 
-	cout << fixed << setprecision(3) << seconds << " seconds. " << bytesIn.tellg() << " bytes in / " << bytesOut.tellg() << " bytes out" << endl;
+	if (unlimitedBits > 0 && !jsonStats && !quiet) // Some blocks had their codes shortened, report what it cost
+	{
+		cout << "Codes limited to " << min(maxCodeLength, BLOCK_MAX_CODE_LENGTH) << " bits: " << (limitedBits + 7) / 8 << " bytes of codes vs " << (unlimitedBits + 7) / 8
+			<< " unlimited (+" << fixed << setprecision(3) << 100.0 * (limitedBits - unlimitedBits) / unlimitedBits << "%)" << endl;
+	}
 
-	bytesIn.close();
-	bytesOut.close();
+	report("encode", start, cout); // Finally, output elapsed time and bytes in/out to console
 
+	return HUFFMAN_OK;
 }
 
-void Huffman::decodeFile(string inputFile, string outputFile)
+void Huffman::encodeStream(istream& input, ostream& output)
 {
-	/* [Public Function]
-	* Decodes inputFile, and outputs the decoded file to outputFile.
-	* 
-	* First, calls rebuildPairOrder to fill pairOrder[] based on inputFile's header.
-	* Using pairOrder[], rebuildTree is called to rebuild the huffman tree based on
-	* pairOrder[]. Then, buildCipher is called to put the cipher keys into charCipher[]
-	* for optimizations. 
+	/* [Public Method]
+	* Encodes everything read from input (like cin) to output (like cout), in a single pass.
 	*
-	* With the tree and all relevant arrays filled, the function then begins to crawl through
-	* inputFile, decoding each bit string into their equivilant char values by traversing down
-	* the tree.
+	* Nothing is printed to cout, since output may be the console, but JSON stats go to cerr if they were
+	* asked for. Only the blocks in flight are held in memory, so any length of stream can be encoded, and
+	* each block is written as soon as it is done. The result is the same as encodeFile would give for a file
+	* with the same bytes.
 	*/
 
-	auto start = std::chrono::steady_clock::now(); // Used to get total elapsed time
-
-	rebuildPairOrder(inputFile);
-	rebuildTree(inputFile);
-	buildCipher(); // Builds the cipher array so the program can know how to encode each letter
+	auto start = std::chrono::steady_clock::now();
+	stats = HuffmanStats();
 
-	unsigned char c;
+	FileReader reader(blockSize, false);
+	reader.open(input);
 
-	ifstream input(inputFile, ios::binary);
-	ofstream output(outputFile, ios::binary);
+	ostream* tied = input.tie(nullptr); // input is read on one thread while output is written on another, so reading mustn't flush output (cin flushes cout)
+	encodeBlocks(reader, output);
+	output.flush();
+	input.tie(tied);
 
-	for (int i = 0; i < 510; i++) input.read((char*)&c, sizeof(c)); // Burn through first 510 bytes in file to get to encoded file
+	if (jsonStats) report("encode", start, cerr);
+}
 
-	int maxPathLength = charCipher[0].length();
-	for (int i = 1; i < 255; i++) if (charCipher[i].length() > maxPathLength) maxPathLength = charCipher[i].length(); // finds the length of the longest path in the cipher array
+HuffmanStatus Huffman::decodeStream(istream& input, ostream& output)
+{
+	/* [Public Method]
+	* Decodes a block file read from input (like cin) to output (like cout), in a single pass.
+	*
+	* The blocks are decoded one at a time as they arrive, so only one block is held in memory. Only block
+	* files can be read this way, since the older formats need to seek back to their header. Like encodeStream,
+	* only JSON stats and errors are printed, to cerr.
+	*
+	* Returns HUFFMAN_UNSUPPORTED if input isn't a block file, HUFFMAN_CORRUPT if a block doesn't decode
+	* (everything before it has already been written), otherwise HUFFMAN_OK.
+	*/
 
-	int minPathLength = charCipher[0].length();
-	for (int i = 1; i < 255; i++) if (charCipher[i].length() < minPathLength) minPathLength = charCipher[i].length(); // finds the length of the shortest path in the cipher array
+	auto start = std::chrono::steady_clock::now();
+	stats = HuffmanStats();
 
+	int version = readHeader(input, cerr);
 
-	HNode* traverse = root;
+	if (version < 0) return HUFFMAN_CORRUPT;
 
-	while (input.read((char*)&c, sizeof(c)))
+	if (version != BLOCK_FORMAT)
 	{
-
-		for (int i = 128; i >= 1; i = i >> 1) // Starts at 2^7, then goes down to 2^6, 2^5....
-		{
-			if (c & i) traverse = traverse->rPtr; // If the indexed bit in the read byte is 1, go left down the tree
-			else traverse = traverse->lPtr; // else, go right down the tree
-
-			if (traverse->lPtr == nullptr && traverse->rPtr == nullptr) // We hit a leaf! reset traverse and print key to file
-			{
-				output.write((char*)&traverse->key, sizeof(traverse->key));
-				traverse = root;
-			}
-
-		}
-
+		cerr << "Only block files can be decoded from a stream" << endl;
+		return HUFFMAN_UNSUPPORTED;
 	}
 
-	input.close(); // Need to close files before exiting
-	output.close();
-
-	auto end = std::chrono::steady_clock::now();
+	stats.bytesIn = 7;
+	ostream* tied = input.tie(nullptr); // Read and written on separate threads, like encodeStream
+	bool decoded = decodeBlocks("", input, output);
+	output.flush();
+	input.tie(tied);
 
-	ifstream bytesIn(inputFile, ios::binary | ios::ate); // Finally, output elapsed time and bytes in/out to console
-	ifstream bytesOut(outputFile, ios::binary | ios::ate);
+	if (!decoded)
+	{
+		cerr << "Corrupt block in file" << endl;
+		return HUFFMAN_CORRUPT;
+	}
 
-	double totalMs = (std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()); // gets the total number of elapsed milliseconds and divides it by 1000
+	if (jsonStats) report("decode", start, cerr);
+	return HUFFMAN_OK;
+}
 
-	double seconds = totalMs / 1000; // Divide that number by 1000 to get total elapsed seconds
+HuffmanStatus Huffman::encodeFiles(const vector<string>& inputFiles)
+{
+	/* [Public Method]
+	* Encodes every file in inputFiles, each to its own name with .huf added (so a.txt and a.bin don't
+	* collide), on setThreads threads. Prints one summary for the whole batch.
+	*
+	* Returns HUFFMAN_OK if every file was encoded, otherwise the status of a file that wasn't.
+	*/
 
-	cout << fixed << setprecision(3) << seconds << " seconds. " << bytesIn.tellg() << " bytes in / " << bytesOut.tellg() << " bytes out" << endl;
+	return codeFiles(inputFiles, false);
+}
 
-	bytesIn.close();
-	bytesOut.close();
+HuffmanStatus Huffman::decodeFiles(const vector<string>& inputFiles)
+{
+	/* [Public Method]
+	* Decodes every file in inputFiles, each to its own name with .huf taken off (or .out added if it
+	* doesn't end in .huf), on setThreads threads. Prints one summary for the whole batch.
+	*
+	* Returns HUFFMAN_OK if every file was decoded, otherwise the status of a file that wasn't.
+	*/
 
+	return codeFiles(inputFiles, true);
 }
 
-void Huffman::makeTreeBuilder(string inputFile, string outputFile)
+HuffmanStatus Huffman::codeFiles(const vector<string>& inputFiles, bool decoding)
 {
-	/* [Public Method]
-	* Creates a tree builder file that can be used to
-	* encode a target file with a tree built based on
-	* another file.
+	/* [Private Method]
+	* Runs a batch of files through one process, so each file costs only its own coding and not a process
+	* start and a fresh Huffman object.
+	*
+	* Each file is one task on a work-stealing ThreadPool, and each worker has its own Huffman object with
+	* this object's settings, reused from file to file along with its buffers and tables. Every file is coded
+	* on a single thread, since the batch itself keeps the threads busy. The files are submitted biggest
+	* first, so the small ones fill in the gaps at the end instead of one big file finishing last on its own.
+	*
+	* Files that don't exist (or aren't regular files) are reported and skipped. A file that fails to code
+	* doesn't stop the batch: its partial output is removed, and once the rest are done every failed file is
+	* listed and its status returned. An exception thrown while coding a file (like bad_alloc, or a
+	* filesystem_error) is caught in the task and counts as that file failing with HUFFMAN_FAILED.
 	*/
 
-	auto start = std::chrono::steady_clock::now(); // Used to get total elapsed time
+	auto start = std::chrono::steady_clock::now();
+	stats = HuffmanStats();
+	stats.files = 0;
 
-	countChar(inputFile); // Update char weights
-	initTree(inputFile); // Builds tree based on char weights
+	vector<pair<unsigned long long, string>> jobs; // Size and name of every file
+	HuffmanStatus result = HUFFMAN_OK;
 
-	if (outputFile == "") // If outputFile is not specified, set its name to the input file w/ extension .huf
+	for (const string& file : inputFiles)
 	{
-		size_t last = inputFile.find_last_of('.');
-		outputFile = inputFile.substr(0, last);
-		outputFile += ".htree";
+		error_code error;
+		if (!filesystem::is_regular_file(file, error))
+		{
+			cout << "Unable to open file: " << file << endl;
+			result = HUFFMAN_NO_FILE;
+			continue;
+		}
+		jobs.push_back({ filesystem::file_size(file, error), file });
 	}
-	else if (outputFile.find('.') == string::npos) // This happens when the user specifies a file name but not an extension
+
+	stable_sort(jobs.begin(), jobs.end(), [](const pair<unsigned long long, string>& a, const pair<unsigned long long, string>& b) { return a.first > b.first; });
+
+	Huffman* coders = new Huffman[threads];
+	vector<HuffmanStats> totals(threads); // Each worker's stats, added up file by file
+	struct FailedFile
 	{
-		outputFile += ".htree";
+		string name;
+		HuffmanStatus status;
+		string reason; // what() of the exception that stopped it, if there was one
+	};
+
+	vector<vector<FailedFile>> failed(threads); // Each worker's files that didn't code, and why
+
+	for (int i = 0; i < threads; i++)
+	{
+		coders[i].maxCodeLength = maxCodeLength;
+		coders[i].blockSize = blockSize;
+		coders[i].streams = streams;
+		coders[i].contextTables = contextTables;
+		coders[i].histogramStride = histogramStride;
+		coders[i].useMapping = useMapping;
+		coders[i].quiet = true;
+		coders[i].pipelined = false; // The batch already keeps every core busy
+		totals[i].files = 0;
 	}
 
-	ofstream output(outputFile, ios::binary);
+	ThreadPool* pool = new ThreadPool(threads);
 
-	for (int i = 0; i < 510; i++) output.write((char*)&pairOrder[i], sizeof(pairOrder[i])); // Writes the 510-byte header to the output file
+	for (const pair<unsigned long long, string>& job : jobs)
+	{
+		string inputFile = job.second;
 
-	output.close();
+		pool->submit([&, inputFile](int worker)
+		{
+			Huffman& coder = coders[worker];
+			string outputFile = inputFile + ".huf";
+			HuffmanStatus status;
+
+			if (decoding)
+			{
+				size_t length = inputFile.size();
+				if (length > 4 && inputFile.compare(length - 4, 4, ".huf") == 0) outputFile = inputFile.substr(0, length - 4);
+				else outputFile = inputFile + ".out";
+			}
+
+			try
+			{
+				if (decoding) status = coder.decodeFile(inputFile, outputFile);
+				else status = coder.encodeFile(inputFile, outputFile);
+			}
+			catch (const exception& e) // The future is never read, so this is the only place to hear about it
+			{
+				error_code error;
+				filesystem::remove(outputFile, error);
+				failed[worker].push_back({ inputFile, HUFFMAN_FAILED, e.what() });
+				return;
+			}
+
+			if (status != HUFFMAN_OK)
+			{
+				failed[worker].push_back({ inputFile, status, "" });
+				return;
+			}
 
-	auto end = std::chrono::steady_clock::now();
+			totals[worker].add(coder.stats);
+			totals[worker].bytesIn += coder.stats.bytesIn;
+			totals[worker].bytesOut += coder.stats.bytesOut;
+			totals[worker].files++;
+		});
+	}
 
-	ifstream bytesIn(inputFile, ios::binary | ios::ate); // Finally, output elapsed time and bytes in/out to console
-	ifstream bytesOut(outputFile, ios::binary | ios::ate);
+	delete pool; // Waits for every file to finish
 
-	double totalMs = (std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()); // gets the total number of elapsed milliseconds and divides it by 1000
+	for (int i = 0; i < threads; i++)
+	{
+		stats.add(totals[i]);
+		stats.bytesIn += totals[i].bytesIn;
+		stats.bytesOut += totals[i].bytesOut;
+		stats.files += totals[i].files;
 
-	double seconds = totalMs / 1000; // Divide that number by 1000 to get total elapsed seconds
+		for (const FailedFile& file : failed[i])
+		{
+			cout << "Unable to " << (decoding ? "decode" : "encode") << " file: " << file.name << (file.reason != "" ? " (" + file.reason + ")" : "") << endl;
+			result = file.status;
+		}
+	}
 
-	cout << fixed << setprecision(3) << seconds << " seconds. " << bytesIn.tellg() << " bytes in / " << bytesOut.tellg() << " bytes out" << endl;
+	delete[] coders;
 
-	bytesIn.close();
-	bytesOut.close();
+	report(decoding ? "decode" : "encode", start, cout);
 
+	return result;
 }
 
-void Huffman::encodeFileWithTree(string inputFile, string treeFile, string outputFile)
+HuffmanStatus Huffman::encode(span<const unsigned char> input, vector<unsigned char>& output)
 {
 	/* [Public Method]
-	* First, initlizes the pair order and tree tree based on treeFile
-	* Then, calls buildCipher to get the encoded key paths based on the tree
-	* Finally, calls writeCodeToFile() to encode and compress input file into outputFile
+	* Encodes input into output, replacing what output held. The result is a BLOCK_FORMAT file, the same
+	* bytes encodeFile would write for a file holding input (on one thread).
+	*
+	* Nothing is printed and nothing is allocated besides output, which is grown once to the most the
+	* encoded file can take up (every code is at most 8 bits on average, since a flat 8-bit code is always
+	* an option). Each block can add its record header, its index entry, and the largest length table, jump
+	* table and stream padding a BLOCK_HUFFMAN4 block can have. BLOCK_CONTEXT and BLOCK_STORED payloads are
+	* never longer than their block. Reusing the same output vector across calls avoids even that once it is
+	* big enough.
+	*
+	* Returns HUFFMAN_OK. Every object has its own tables, so separate objects can be used on separate
+	* threads at the same time.
 	*/
 
-	auto start = std::chrono::steady_clock::now(); // Used to get total elapsed time
-
-	rebuildPairOrder(treeFile); // rebuilds pair order array
-	rebuildTree(treeFile); // Builds tree based on char weights
-	buildCipher(); // Builds the cipher array so the program can know how to encode each letter
-	writeCodeToFile(inputFile, outputFile); // uses the tree and cipher array to encode inputFile
+	size_t blocks = (input.size() + blockSize - 1) / blockSize;
 
-	// Its ugly to have this here, but needed as the output file name is proccessed in writeCodeToFile()
-	if (outputFile == "") // If outputFile is not specified, set its name to the input file w/ extension .huf
-	{
-		size_t last = inputFile.find_last_of('.');
-		outputFile = inputFile.substr(0, last);
-		outputFile += ".huf";
-	}
-	else if (outputFile.find('.') == string::npos) // This happens when the user specifies a file name but not an extension
-	{
-		outputFile += ".huf";
-	}
+	stats = HuffmanStats();
+	output.clear();
+	size_t blockOverhead = BLOCK_HEADER_SIZE + LENGTH_TABLE_SIZE + 4 * (BLOCK_STREAMS - 1) + BLOCK_STREAMS + INDEX_ENTRY_SIZE; // Header, table, jump table, a padding byte per stream and index entry
+	output.reserve(7 + input.size() + blocks * blockOverhead + BLOCK_HEADER_SIZE + INDEX_FOOTER_SIZE);
 
-	auto end = std::chrono::steady_clock::now();
+	output.resize(7);
+	output[0] = 'H';
+	output[1] = 'F';
+	output[2] = BLOCK_FORMAT;
+	for (int i = 0; i < 4; i++) output[3 + i] = (unsigned char)(blockSize >> (8 * i));
 
-	ifstream bytesIn(inputFile, ios::binary | ios::ate); // Finally, output elapsed time and bytes in/out to console
-	ifstream bytesOut(outputFile, ios::binary | ios::ate);
+	unlimitedBits = limitedBits = 0;
+	indexScratch.clear();
 
-	double totalMs = (std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()); // gets the total number of elapsed milliseconds and divides it by 1000
+	for (size_t rawOffset = 0; rawOffset < input.size(); rawOffset += blockSize)
+	{
+		size_t length = min(blockSize, input.size() - rawOffset);
+		unsigned long long compressedOffset = output.size();
 
-	double seconds = totalMs / 1000; // Divide that number by 1000 to get total elapsed seconds
+		unsigned long long bits = encodeBlock(input.data() + rawOffset, length, output);
+		indexScratch.push_back({ compressedOffset, rawOffset, bits });
+	}
 
-	cout << fixed << setprecision(3) << seconds << " seconds. " << bytesIn.tellg() << " bytes in / " << bytesOut.tellg() << " bytes out" << endl;
+	output.resize(output.size() + BLOCK_HEADER_SIZE, 0); // Empty record marks the end of the file
+	writeIndex(output, indexScratch, input.size());
 
-	bytesIn.close();
-	bytesOut.close();
+	stats.bytesIn = input.size();
+	stats.bytesOut = output.size();
 
+	return HUFFMAN_OK;
 }
 
-void Huffman::countChar(string inputFile)
+HuffmanStatus Huffman::decode(span<const unsigned char> input, vector<unsigned char>& output)
 {
-/* [Private Method]
-*  Creates an instance of ifstream to target file.
-* 
-*  Crawls through the file buffer-by-buffer and updates the node weights for every instance a byte
-*  appears in the file.
-* 
-*/
-
-	ifstream input(inputFile,ios::binary);
+	/* [Public Method]
+	* Decodes a BLOCK_FORMAT file held in input into output, replacing what output held.
+	*
+	* Nothing is printed, and corrupt input never ends the program. The records are first walked to check
+	* they fit in input and to add up the decoded size, so output is sized once, then each block is decoded
+	* straight into its place in output.
+	*
+	* Returns HUFFMAN_OK, HUFFMAN_UNSUPPORTED if input isn't a BLOCK_FORMAT file (older formats can only be
+	* decoded from a file), or HUFFMAN_CORRUPT if it is damaged. output is cleared on error.
+	*/
 
-	if (!input.is_open())
-	{
-		cout << "Unable to open file: " << inputFile << endl;
-		exit(0);
-		return;
-	}
+	stats = HuffmanStats();
+	output.clear();
 
-	unsigned char buffer[BUFF_SIZE]; // Buffer code reads into
+	if (input.size() < 7 || input[0] != 'H' || input[1] != 'F') return HUFFMAN_UNSUPPORTED;
+	if (input[2] != BLOCK_FORMAT) return HUFFMAN_UNSUPPORTED;
 
-	while (!input.eof())
-	{
-		input.read((char*)buffer, BUFF_SIZE); // reads 512 bytes into buffer
-		unsigned char* p = buffer;
+	size_t size = 0;
+	for (int i = 0; i < 4; i++) size |= (size_t)input[3 + i] << (8 * i);
+	if (size == 0 || size > MAX_BLOCK_SIZE) return HUFFMAN_CORRUPT;
 
-		if (input.gcount() == BUFF_SIZE) // If the read filled the buffer....
-		{
-			for (int i = 0; i < BUFF_SIZE; i++) leaves[*(p++)]->weight++; // ... Adjust weights for every leaf in array ...
-		}
-		else
-		{
-			for (int i = 0; i < input.gcount(); i++) leaves[*(p++)]->weight++; // ... Else, only adjust weights for how filled the buffer is ...
-			break;
-		}
+	size_t rawSize = 0;
+	size_t offset = 7;
 
-	}
+	while (true) // First pass: check every record fits, and add up the decoded size
+	{
+		if (input.size() - offset < BLOCK_HEADER_SIZE) return HUFFMAN_CORRUPT;
 
-	input.close();
-}
+		size_t rawLength, payloadLength;
+		readRecordHeader(input.data() + offset, rawLength, payloadLength);
+		offset += BLOCK_HEADER_SIZE;
 
-HNode* Huffman::getMinNode(HNode* exclude)
-{
-	/* [Private Method]
-	Returns the node with the minimum weight in the array 
+		if (rawLength == 0) break; // End of file
+		if (rawLength > size || input.size() - offset < payloadLength) return HUFFMAN_CORRUPT;
 
-	If exclude is passed, this method will return the node with the smallest weight in the array, unless it is equal to exclude.
+		rawSize += rawLength;
+		offset += payloadLength;
+	}
 
-	*/
+	output.resize(rawSize);
 
-	HNode* target = leaves[0];
+	offset = 7;
+	size_t rawOffset = 0;
 
-	if (target == exclude)  // If we have passed leaves[0] as the node to exclude, find next non-nullptr node in leaves[] to start loop with
+	while (rawOffset < rawSize) // Second pass: decode each block into place
 	{
-		for (int i = 1; i < 256; i++) // start at 1 because leaves[0] is excluded
+		size_t rawLength, payloadLength;
+		const unsigned char* header = input.data() + offset;
+		readRecordHeader(header, rawLength, payloadLength);
+		offset += BLOCK_HEADER_SIZE;
+
+		if (!decodeBlock(input.data() + offset, payloadLength, header[4], output.data() + rawOffset, rawLength))
 		{
-			if (leaves[i] != nullptr)
-			{
-				target = leaves[i];
-				break;
-			}
+			output.clear();
+			return HUFFMAN_CORRUPT;
 		}
-	}
-
-	for (int i = 0; i < 256; i++) // crawl through leaf array
-	{
-		if ((leaves[i] != nullptr) && (leaves[i]->weight < target->weight) && (exclude != leaves[i])) target = leaves[i]; // Update target if the next element in array is less than or equal to it
 
+		rawOffset += rawLength;
+		offset += payloadLength;
 	}
 
-	return target;
+	stats.bytesIn = input.size();
+	stats.bytesOut = rawSize;
 
+	return HUFFMAN_OK;
 }
 
-void Huffman::initTree(string inputFile)
+unsigned long long Huffman::encodeBlocks(FileReader& input, ostream& output)
 {
 	/* [Private Method]
-	 IMPORTANT: BEFORE CALLING MAKE SURE TO UPDATE THE CHAR COUNT ARRAY USING countChar()
-	
-	 Builds the tree that will be used to encode file by pairing nodes together. Lower weighted nodes will be paired first, and
-	 then heigher weighted nodes will get paired.
-	
-	 Since there is at most 256 items in the leaves array, there will be exactly 255 pairs made. Each pairing will be saved to a string
-	 that will later be used as a 510-byte tree-builder header.
-
-	 Once built, the global root pointer will be pointed to the proper node: leaves[0].
-	
+	* Encodes everything input hands out as a BLOCK_FORMAT file written to output, and returns the number of
+	* bytes encoded.
+	* 
+	* The input is cut into blocks of blockSize bytes, and each block is encoded on its own by encodeBlock:
+	* it gets its own byte counts, its own tree, and its own code lengths, so parts of the file that look
+	* different get codes that suit them. When input is mapped each block is encoded straight from the
+	* mapping, otherwise each one is read into its slot's buffer.
+	*
+	* The blocks go through a Pipeline: a reader thread reads each one into its slot, this thread encodes it
+	* (or hands it to a worker), and a writer thread writes it out, so reading, encoding and writing all
+	* overlap. The slots are reused in order, so the blocks come out in the order they went in.
+	*
+	* With more than one thread, the blocks are handed to a thread pool where each worker has its own Huffman
+	* object. Up to two blocks per thread (plus the ones being read and written) are in flight at a time, and
+	* the writer waits for each one in turn.
+	* 
+	* The output is "HF", BLOCK_FORMAT, and the block size (4 bytes, little endian), followed by each
+	* block's record and finally an empty record marking the end. After that comes the seek index (see
+	* writeIndex), which lets decodeFile find every block without reading the ones before it.
 	*/
 
-	int pairIndex = 0;
+	unsigned char header[7] = { 'H', 'F', BLOCK_FORMAT };
+	for (int i = 0; i < 4; i++) header[3 + i] = (unsigned char)(blockSize >> (8 * i));
+	output.write((char*)header, 7);
 
-	for (int i = 0; i < 255; i++) // Build tree
+	struct BlockSlot
 	{
-		HNode* min = getMinNode(); // gets least weighted node in the whole array (Biased towards lower subscripts)
-
-		HNode* secondMin = getMinNode(min); // gets second least weighted node in array
-
-		HNode* parent = new HNode; // create new parent node
-		parent->weight = min->weight + secondMin->weight; // parent node's weight will be equal to the sum of it's children
-
-
-		if (min->key < secondMin->key)
-		{
-			pairOrder[pairIndex] = min->key;
-			pairIndex++;
-			pairOrder[pairIndex] = secondMin->key;
-			pairIndex++;
-
-			parent->lPtr = min; // lower-subscripted nodes go the the left... 
-			parent->rPtr = secondMin; // ... And higher subscripted nodes go to the right
-			parent->key = min->key; // The parent will inheret its right-childs key. (This is used to keep track of where it will end up in the array)
-
-			leaves[min->key] = parent; // Set minimum node's pointer in array to null
-			leaves[secondMin->key] = nullptr; // Set larger node's pointer in array to point to its parent
-		}
-		else
-		{
-			pairOrder[pairIndex] = secondMin->key;
-			pairIndex++;
-			pairOrder[pairIndex] = min->key;
-			pairIndex++;
-
-			parent->lPtr = secondMin; // lower-subscripted nodes go the the left... 
-			parent->rPtr = min; // ... And higher subscripted nodes go to the right
-			parent->key = secondMin->key; // The parent will inheret its right-childs key. (This is used to keep track of where it will end up in the array)
+		vector<unsigned char> buffer; // Holds the block when the input isn't mapped
+		const unsigned char* data = nullptr; // The block's bytes, either in buffer or in the mapping
+		size_t length = 0;
+		vector<unsigned char> record; // The encoded block
+		unsigned long long bits = 0; // Length of the block's bitstream
+		future<void> done; // Ready once a worker has encoded the block
+	};
+
+	ThreadPool* pool = threads > 1 ? new ThreadPool(threads) : nullptr;
+	Huffman* coders = threads > 1 ? new Huffman[threads] : nullptr; // One per worker, so they don't share any state
+	for (int i = 0; i < threads && coders != nullptr; i++)
+	{
+		coders[i].maxCodeLength = maxCodeLength;
+		coders[i].streams = streams;
+		coders[i].contextTables = contextTables;
+		coders[i].histogramStride = histogramStride;
+	}
 
-			leaves[secondMin->key] = parent; // Set minimum node's pointer in array to null
-			leaves[min->key] = nullptr; // Set larger node's pointer in array to point to its parent
-		}
+	Pipeline pipeline(pool != nullptr ? 2 * threads + 2 : PIPELINE_SLOTS, pipelined || pool != nullptr);
+	vector<BlockSlot> slots(pipeline.size());
+	unlimitedBits = limitedBits = 0;
 
-	}
+	vector<BlockIndexEntry> index;
+	unsigned long long compressedOffset = 7; // Where the next record starts in the output
+	unsigned long long rawOffset = 0; // Where the next block starts in the input
 
-	root = leaves[0]; // Set the root node as the final node in the array
+	HuffmanStats readStats, writeStats; // The reader and writer time their I/O here, apart from this thread's stats
 
-}
+	pipeline.run([&](size_t i) // Reads the next block, returns false at the end of the input
+	{
+		[[maybe_unused]] HuffmanStats& stats = readStats;
+		BlockSlot& slot = slots[i];
 
-void Huffman::rebuildTree(string inputFile)
-{
-	/* [Private Method]
-	 IMPORTANT: MAKE SURE TO CALL rebuildPairOrder() BEFORE CALLING
-	
-	 Reuilds the tree that will be used to decode file by pairing nodes together.
+		if (!input.isMapped()) slot.buffer.resize(blockSize);
 
-	 Once built, the global root pointer will be pointed to the proper node.
+		STATS_START(readStart);
+		slot.length = input.next(slot.data, slot.buffer.data());
+		STATS_STOP(ioNs, readStart);
 
-	 Functionally similar to initTree, however this method gets the order to pair nodes from the pairOrder array.
-	*/
+		return slot.length > 0;
+	},
+	[&](size_t i) // Encodes it, here or on a worker
+	{
+		BlockSlot& slot = slots[i];
+		slot.record.clear();
 
-	int pairIndex = 0;
+		if (pool == nullptr) slot.bits = encodeBlock(slot.data, slot.length, slot.record);
+		else slot.done = pool->submit([&slot, coders](int worker) { slot.bits = coders[worker].encodeBlock(slot.data, slot.length, slot.record); });
 
-	for (int i = 0; i < 255; i++) // Build tree
+		return true;
+	},
+	[&](size_t i) // Writes it out once it's done, and adds it to the index
 	{
-		HNode* min = leaves[pairOrder[pairIndex]]; 
-		pairIndex++;
+		[[maybe_unused]] HuffmanStats& stats = writeStats;
+		BlockSlot& slot = slots[i];
 
-		HNode* secondMin = 	leaves[pairOrder[pairIndex]];
-		pairIndex++;
+		if (pool != nullptr) slot.done.get();
 
-		HNode* parent = new HNode; // create new parent node
+		index.push_back({ compressedOffset, rawOffset, slot.bits });
+		compressedOffset += slot.record.size();
+		rawOffset += slot.length;
 
-		if (min->key < secondMin->key)
-		{
-			parent->lPtr = min; // lower-weighted nodes go the the left... (biased towards end of array)
-			parent->rPtr = secondMin; // ... And higher weighted nodes go to the right
-			parent->key = min->key; // The parent will inheret its right-childs key. (This is used to keep track of where it will end up in the array)
+		STATS_START(writeStart);
+		output.write((char*)slot.record.data(), slot.record.size());
+		STATS_STOP(ioNs, writeStart);
+	});
 
-			leaves[min->key] = parent; // Set minimum node's pointer in array to null
-			leaves[secondMin->key] = nullptr; // Set larger node's pointer in array to point to its parent
-		}
-		else
-		{
-			parent->lPtr = secondMin; // lower-weighted nodes go the the left... (biased towards end of array)
-			parent->rPtr = min; // ... And higher weighted nodes go to the right
-			parent->key = secondMin->key; // The parent will inheret its right-childs key. (This is used to keep track of where it will end up in the array)
+	stats.ioNs += readStats.ioNs + writeStats.ioNs;
 
-			leaves[secondMin->key] = parent; // Set minimum node's pointer in array to null
-			leaves[min->key] = nullptr; // Set larger node's pointer in array to point to its parent
-		}
+	unsigned char endMarker[BLOCK_HEADER_SIZE] = { 0 }; // Empty record marks the end of the file
+	output.write((char*)endMarker, BLOCK_HEADER_SIZE);
+	vector<unsigned char> trailer;
+	writeIndex(trailer, index, rawOffset);
+	output.write((char*)trailer.data(), trailer.size());
 
+	delete pool;
+	for (int i = 0; i < threads && coders != nullptr; i++)
+	{
+		unlimitedBits += coders[i].unlimitedBits;
+		limitedBits += coders[i].limitedBits;
+		stats.add(coders[i].stats);
 	}
+	delete[] coders;
 
-	root = leaves[0]; // Set root of tree to last standing node
+	stats.bytesIn = rawOffset;
+	stats.bytesOut = compressedOffset + BLOCK_HEADER_SIZE + trailer.size();
 
+	return rawOffset;
 }
 
-void Huffman::rebuildPairOrder(string inputFile)
+HuffmanStatus Huffman::decodeFile(string inputFile, string outputFile)
 {
-	/* [Private Method]
+	/* [Public Function]
+	* Decodes inputFile, and outputs the decoded file to outputFile.
 	* 
-	* Crawls through the first 510
-	* bytes from a target file and
-	* puts it in pairOrder[].
+	* First, calls readHeader to check which format inputFile is in. Block files are handed to
+	* decodeBlocks, which decodes one block at a time with each block's own code lengths. With more than
+	* one thread, and a seek index at the end of the file, they go to decodeIndexedBlocks instead, which
+	* decodes the blocks in parallel straight into their place in outputFile.
+	*
+	* Single-stream canonical files store their code lengths, which compileDecoderFromLengths turns
+	* straight into a lookup table indexed by the next DECODE_BITS bits of the stream. Legacy files get
+	* rebuildPairOrder to fill pairOrder[] based on inputFile's header, rebuildTree to rebuild the huffman
+	* tree based on pairOrder[], and compileDecoder to turn the tree into the same lookup table.
+	* Either way, decodeBitstream then decodes the rest of the file.
+	*
+	* Returns HUFFMAN_NO_FILE if inputFile can't be opened, or HUFFMAN_CORRUPT if its header or a block is
+	* damaged, in which case outputFile is removed rather than left half written. Otherwise returns HUFFMAN_OK.
 	*/
 
+	auto start = std::chrono::steady_clock::now(); // Used to get total elapsed time
+	stats = HuffmanStats();
+
 	ifstream input(inputFile, ios::binary);
-	unsigned char c; // will be used to hold byte at indexed location in for loop
 
 	if (!input.is_open())
 	{
 		cout << "Unable to open file: " << inputFile << endl;
-		exit(0);
-		return;
+		return HUFFMAN_NO_FILE;
 	}
 
-	for (int i = 0; i < 510; i++)
-	{
-		input.read((char*)&c,sizeof(c));
-		pairOrder[i] = c; // Writes the 510-byte header to the output file
+	input.seekg(0, ios::end); // Size of inputFile, for the summary
+	unsigned long long inputSize = input.tellg();
+	input.seekg(0);
 
-	}
+	int version = readHeader(input, cout);
 
-	input.close();
-}
+	if (version < 0) return HUFFMAN_CORRUPT; // Nothing has been written yet
 
-void Huffman::buildCipher(string path, HNode* traverse)
-{
-/* [Private Method]
- Recursivley traverses the tree, passing down a string to keep track of the path for each node.
- Once the method hits a leaf, it stores the path it took into charCipher[traverse->key].
- More common characters will have shorter paths, while rarer characters will have longer paths.
-*/
-	if (traverse == nullptr) traverse = root; // If traverse is a nullptr, then this method is being called directly
+	ofstream output(outputFile, ios::binary);
+
+	vector<BlockIndexEntry> index;
+	unsigned long long rawSize = 0;
+	bool decoded = true;
 
-	if (traverse->lPtr != nullptr)
+	if (version == BLOCK_FORMAT && threads > 1 && readIndex(input, index, rawSize)) // Blocks can be found without reading through the file
+	{
+		output.close();
+		decoded = decodeIndexedBlocks(inputFile, outputFile, index, rawSize);
+	}
+	else if (version == BLOCK_FORMAT) // Each block carries its own code lengths
 	{
-		string newPath = path + "0";
-		buildCipher(newPath, traverse->lPtr);
+		decoded = decodeBlocks(inputFile, input, output);
+		if (!decoded) cout << "Corrupt block in file" << endl;
 	}
+	else if (version == STREAM_FORMAT) // Canonical file, the decoder can be built straight from the code lengths
+	{
+		STATS_START(tableStart);
+		compileDecoderFromLengths();
+		STATS_STOP(tableNs, tableStart);
 
-	if (traverse->rPtr != nullptr)
+		decodeBitstream(input, output, symbolCount);
+	}
+	else // Legacy file starting with a 510-byte pairOrder header
 	{
-		string newPath = path + "1";
-		buildCipher(newPath, traverse->rPtr);
+		rebuildPairOrder(inputFile);
+
+		STATS_START(treeStart);
+		decoded = rebuildTree(inputFile);
+		STATS_STOP(treeNs, treeStart);
+
+		if (decoded)
+		{
+			STATS_START(tableStart);
+			compileDecoder(); // Compiles the tree into a lookup table so whole codes can be resolved at once
+			STATS_STOP(tableNs, tableStart);
+
+			input.seekg(510); // Skip the 510-byte header to get to encoded file
+			decodeBitstream(input, output, ULLONG_MAX); // Legacy files don't store their length, decode until the bits run out
+		}
 	}
 
-	// When both children are nullptrs, node is a leaf
 
-	if (traverse->rPtr == nullptr && traverse->lPtr == nullptr) charCipher[traverse->key] = path;
+	input.close(); // Need to close files before exiting
+	output.close();
+
+	if (!decoded)
+	{
+		error_code error;
+		filesystem::remove(outputFile, error); // Don't leave a half-decoded file behind
+		return HUFFMAN_CORRUPT;
+	}
+
+	stats.bytesIn = inputSize;
+	report("decode", start, cout); // Finally, output elapsed time and bytes in/out to console
 
+	return HUFFMAN_OK;
 }
 
-void Huffman::writeCodeToFile(string inputFile, string outputFile)
+void Huffman::decodeBitstream(ifstream& input, ofstream& output, unsigned long long symbolsLeft)
 {
 	/* [Private Method]
-	*  
-	* == IMPRORTANT, MAKE SURE THAT countChar(), initTree(), & buildCipher() BEEN CALLED
-	* BEFORE CALLING THIS METHOD TO INITIALIZE ALL RELEVANT ARRAYS AND THE TREE ==============
-	* 
-	* Using the cipher key generated by buildCipher, this method parses through inputFile and generates
-	* a bit string to be placed into outputFile. A queue is used to keep track of the order of bits to 
-	* be added into outputFile. outputFile will be written to byte-by-byte. If the bit string is not divisible
-	* by 8, up to 7 padding 0s will be present at the end of the file. Because the decoder works by traversing
-	* down the tree until it finds a node, these bits will be discarded and not effect the decoding.
+	* IMPORTANT: MAKE SURE decodeTable[] AND decodeNodes[] HAVE BEEN COMPILED BEFORE CALLING
+	*
+	* Decodes a single bitstream running from the current position of input to the end of the file.
+	*
+	* The function crawls through input a large buffer at a time, keeping up to 64 upcoming bits in a
+	* bit buffer. Each table lookup resolves a whole code and its length at once, only codes longer than
+	* DECODE_BITS fall back to walking the tree. Decoding stops after symbolsLeft bytes, or when the
+	* bits run out.
 	*/
 
-	if (outputFile == "") // If outputFile is not specified, set its name to the input file w/ extension .huf
-	{
+	unsigned char* inBuffer = new unsigned char[CODER_BUFF_SIZE + 8]; // Read from inputFile (+8 so a full word can always be loaded)
+	unsigned char* outBuffer = new unsigned char[CODER_BUFF_SIZE]; // Written to outputFile
+	size_t inLength = 0; // Number of valid bytes in inBuffer
+	size_t inIndex = 0; // Next byte in inBuffer that hasn't been loaded into bitBuffer
+	size_t outIndex = 0;
+	size_t outLimit = symbolsLeft < CODER_BUFF_SIZE ? symbolsLeft : CODER_BUFF_SIZE; // outBuffer gets written out once outIndex reaches this
+
+	unsigned long long bitBuffer = 0; // Upcoming bits of the stream, left-aligned
+	int bitCount = 0; // Number of valid bits in bitBuffer
+	bool endOfInput = false;
+
+	STATS_START(decodeStart);
+	[[maybe_unused]] unsigned long long ioBefore = stats.ioNs; // I/O is timed on its own, and taken back out of the coding time at the end
+	STATS_ADD(blocks, 1);
+
+	while (symbolsLeft > 0)
+	{
+		if (inLength - inIndex < 8 && !endOfInput) // Running low on bytes, slide what is left to the front and read more
+		{
+			inLength -= inIndex;
+			for (size_t i = 0; i < inLength; i++) inBuffer[i] = inBuffer[inIndex + i];
+			inIndex = 0;
+
+			STATS_START(readStart);
+			input.read((char*)inBuffer + inLength, CODER_BUFF_SIZE - inLength);
+			STATS_STOP(ioNs, readStart);
+
+			inLength += input.gcount();
+			if (input.gcount() == 0) endOfInput = true;
+		}
+
+		if (inLength - inIndex >= 8) // Fast refill: load 8 bytes big-endian and keep as many whole bytes as fit
+		{
+			unsigned long long word = 0;
+			for (int i = 0; i < 8; i++) word = (word << 8) | inBuffer[inIndex + i];
+			bitBuffer |= word >> bitCount;
+			inIndex += (63 - bitCount) >> 3;
+			bitCount |= 56;
+		}
+		else // Near the end of the file, refill byte-by-byte
+		{
+			while (bitCount <= 56 && inIndex < inLength)
+			{
+				bitBuffer |= (unsigned long long)inBuffer[inIndex++] << (56 - bitCount);
+				bitCount += 8;
+			}
+		}
+
+		if (bitCount < DECODE_BITS) break; // Not enough bits left for a table lookup, the tail is handled below
+
+		while (bitCount >= DECODE_BITS && outIndex < outLimit) // Decode symbols until the buffer needs a refill
+		{
+			const DecodeEntry& entry = decodeTable[bitBuffer >> (64 - DECODE_BITS)];
+
+			if (entry.length != 0) // The whole code fit in the table
+			{
+				outBuffer[outIndex++] = (unsigned char)entry.symbol;
+				bitBuffer <<= entry.length;
+				bitCount -= entry.length;
+			}
+			else // Code is longer than DECODE_BITS, walk the rest of it bit-by-bit
+			{
+				bitBuffer <<= DECODE_BITS;
+				bitCount -= DECODE_BITS;
+
+				int node = entry.symbol;
+				while (node >= 0 && bitCount > 0)
+				{
+					node = decodeNodes[node][bitBuffer >> 63];
+					bitBuffer <<= 1;
+					bitCount--;
+				}
+
+				if (node >= 0) // Ran out of buffered bits partway through a code, pull in more and keep going
+				{
+					while (node >= 0)
+					{
+						if (bitCount == 0)
+						{
+							if (inIndex == inLength && !endOfInput)
+							{
+								input.read((char*)inBuffer, CODER_BUFF_SIZE);
+								inLength = input.gcount();
+								inIndex = 0;
+								if (inLength == 0) endOfInput = true;
+							}
+							if (inIndex == inLength) break; // Stream ended partway through a code
+							bitBuffer = (unsigned long long)inBuffer[inIndex++] << 56;
+							bitCount = 8;
+						}
+						node = decodeNodes[node][bitBuffer >> 63];
+						bitBuffer <<= 1;
+						bitCount--;
+					}
+					if (node >= 0) break;
+				}
+
+				outBuffer[outIndex++] = (unsigned char)~node;
+			}
+
+			if (outIndex == outLimit) // Output buffer is full, write it to the file and reset index
+			{
+				STATS_START(writeStart);
+				output.write((char*)outBuffer, outIndex);
+				STATS_STOP(ioNs, writeStart);
+				stats.bytesOut += outIndex;
+				symbolsLeft -= outIndex;
+				outIndex = 0;
+				outLimit = symbolsLeft < CODER_BUFF_SIZE ? symbolsLeft : CODER_BUFF_SIZE;
+			}
+		}
+	}
+
+	output.write((char*)outBuffer, outIndex);
+	stats.bytesOut += outIndex;
+	symbolsLeft -= outIndex;
+	outIndex = 0;
+
+	// Fewer than DECODE_BITS bits remain. Walk them through the tree so the tail decodes exactly like a bit-by-bit walk would
+
+	int node = 0;
+	while (bitCount > 0 && outIndex < symbolsLeft)
+	{
+		node = decodeNodes[node][bitBuffer >> 63];
+		bitBuffer <<= 1;
+		bitCount--;
+
+		if (node < 0) // We hit a leaf! print key to buffer and start again from the root
+		{
+			outBuffer[outIndex++] = (unsigned char)~node;
+			node = 0;
+		}
+	}
+
+	output.write((char*)outBuffer, outIndex);
+	stats.bytesOut += outIndex;
+
+	STATS_STOP(codingNs, decodeStart);
+	STATS_ADD(codingNs, ioBefore - stats.ioNs);
+
+	delete[] inBuffer;
+	delete[] outBuffer;
+
+}
+
+void Huffman::makeTreeBuilder(string inputFile, string outputFile)
+{
+	/* [Public Method]
+	* Creates a tree builder file that can be used to
+	* encode a target file with a tree built based on
+	* another file.
+	*/
+
+	auto start = std::chrono::steady_clock::now(); // Used to get total elapsed time
+	stats = HuffmanStats();
+
+	countChar(inputFile); // Update char weights
+	for (int i = 0; i < 256; i++) STATS_ADD(byteCounts[i], charCounts[i]);
+
+	STATS_START(treeStart);
+	initTree(true); // Builds tree based on char weights, pairing every byte so it can be saved as a 510-byte header
+	STATS_STOP(treeNs, treeStart);
+
+	if (outputFile == "") // If outputFile is not specified, set its name to the input file w/ extension .huf
+	{
 		size_t last = inputFile.find_last_of('.');
 		outputFile = inputFile.substr(0, last);
-		outputFile += ".huf";
+		outputFile += ".htree";
 	}
 	else if (outputFile.find('.') == string::npos) // This happens when the user specifies a file name but not an extension
 	{
-		outputFile += ".huf";
+		outputFile += ".htree";
 	}
 
-	ifstream input(inputFile, ios::binary);
 	ofstream output(outputFile, ios::binary);
 
-	output.write((char*)pairOrder, 510); // Writes the 510-byte header to the output file
+	for (int i = 0; i < 510; i++) output.write((char*)&pairOrder[i], sizeof(pairOrder[i])); // Writes the 510-byte header to the output file
 
-	if (!input.is_open())
+	output.close();
+
+	stats.bytesIn = symbolCount;
+	stats.bytesOut = 510;
+	report("tree", start, cout); // Finally, output elapsed time and bytes in/out to console
+
+}
+
+void Huffman::makeSharedTable(const vector<string>& inputFiles, string outputFile, size_t sampleFiles)
+{
+	/* [Public Method]
+	* Trains a single code table over a corpus, for SharedTable to encode records with instead of giving
+	* each one its own length table. The bytes of every file are counted together (or, if sampleFiles is
+	* set and there are more files than that, of sampleFiles files spread evenly through the list), and
+	* every byte gets one extra count so that bytes the corpus never used still get a code.
+	*
+	* The table file is "HT", version 1, a table ID (4 bytes, little endian), then a length table (see
+	* writeLengthTable). The ID is a hash of the length table, so training on the same corpus gives the
+	* same ID, and records only decode with the table they were encoded with.
+	*/
+
+	auto start = std::chrono::steady_clock::now(); // Used to get total elapsed time
+	stats = HuffmanStats();
+	stats.files = 0;
+
+	fill_n(charCounts, 256, 0);
+	symbolCount = 0;
+
+	size_t chosen = sampleFiles > 0 && sampleFiles < inputFiles.size() ? sampleFiles : inputFiles.size();
+	ThreadPool* pool = threads > 1 ? new ThreadPool(threads) : nullptr;
+
+	for (size_t i = 0; i < chosen; i++)
 	{
-		cout << "Unable to open file: " << inputFile << endl; // File does not exist, so alert the user and exit
+		string inputFile = inputFiles[i * inputFiles.size() / chosen];
+		FileReader input(blockSize, useMapping);
+
+		if (!input.open(inputFile))
+		{
+			cout << "Unable to open file: " << inputFile << endl;
+			continue;
+		}
+
+		countInput(input, pool);
+		stats.files++;
+	}
+
+	delete pool;
+
+	for (int i = 0; i < 256; i++)
+	{
+		STATS_ADD(byteCounts[i], charCounts[i]);
+		charCounts[i]++; // Every byte needs a code, records can hold bytes the corpus didn't
+	}
+
+	STATS_START(treeStart);
+	initTree(); // Builds tree based on char weights
+	STATS_STOP(treeNs, treeStart);
+
+	STATS_START(tableStart);
+	buildCipher(); // Gets the code length of every byte
+	limitCodeLengths(min(maxCodeLength, BLOCK_MAX_CODE_LENGTH)); // SharedTable decodes with the block decoder, so the block limit applies
+	STATS_STOP(tableNs, tableStart);
+
+	unsigned char table[LENGTH_TABLE_SIZE];
+	int tableSize = writeLengthTable(table);
+
+	unsigned int id = 2166136261u; // FNV-1a hash of the length table
+	for (int i = 0; i < tableSize; i++) id = (id ^ table[i]) * 16777619u;
+
+	for (int i = 0; i < 256; i++) STATS_MAX(maxCodeLength, codeLengths[i]);
+
+	unsigned char header[7] = { 'H', 'T', 1 };
+	for (int i = 0; i < 4; i++) header[3 + i] = (unsigned char)(id >> (8 * i));
+
+	ofstream output(outputFile, ios::binary);
+	output.write((char*)header, 7);
+	output.write((char*)table, tableSize);
+	output.close();
+
+	stats.bytesIn = symbolCount;
+	stats.bytesOut = 7 + tableSize;
+	report("train", start, cout); // Finally, output elapsed time and bytes in/out to console
+
+}
+
+void Huffman::encodeFileWithTree(string inputFile, string treeFile, string outputFile)
+{
+	/* [Public Method]
+	* First, initlizes the pair order and tree tree based on treeFile
+	* Then, calls buildCipher to get the encoded key paths based on the tree
+	* Finally, calls writeCodeToFile() to encode and compress input file into outputFile
+	*/
+
+	auto start = std::chrono::steady_clock::now(); // Used to get total elapsed time
+	stats = HuffmanStats();
+
+	rebuildPairOrder(treeFile); // rebuilds pair order array
+
+	STATS_START(treeStart);
+	if (!rebuildTree(treeFile)) exit(1); // Builds tree based on char weights
+	STATS_STOP(treeNs, treeStart);
+
+	STATS_START(tableStart);
+	buildCipher(); // Builds the cipher array so the program can know how to encode each letter
+	STATS_STOP(tableNs, tableStart);
+
+	writeCodeToFile(inputFile, outputFile); // uses the tree and cipher array to encode inputFile, saving the tree as a 510-byte header
+
+	report("encode", start, cout); // Finally, output elapsed time and bytes in/out to console (writeCodeToFile counted them)
+
+}
+
+HuffmanEstimate Huffman::estimateFile(string inputFile)
+{
+	/* [Public Method]
+	* Works out what encodeFile would write for inputFile with the same settings, without encoding or writing
+	* anything, then prints it with reportEstimate. Each block is counted and given code lengths exactly as
+	* encodeBlock would (see estimateBlock), so the encoded size is exact, unless setHistogramStride has the
+	* counts sampled. setContextTables isn't taken into account, so with it on the size is only an upper bound
+	* (a context block is only written when it is smaller than the order-0 one), and upperBound is set.
+	*
+	* Only the count and a tree per block are done, which is a fraction of the time encoding takes. With
+	* setThreads, the blocks are handed out to a ThreadPool by readChunks, with a Huffman object and an
+	* estimate per worker, like encodeBlocks, and they are added up at the end.
+	*
+	* If inputFile can't be opened, nothing is printed but that, and the estimate's status is HUFFMAN_NO_FILE.
+	*/
+
+	auto start = std::chrono::steady_clock::now(); // Used to get total elapsed time
+	stats = HuffmanStats();
+
+	FileReader input(blockSize, useMapping);
+
+	if (!input.open(inputFile))
+	{
+		cout << "Unable to open file: " << inputFile << endl;
+		HuffmanEstimate missing;
+		missing.status = HUFFMAN_NO_FILE;
+		return missing;
+	}
+
+	ThreadPool* pool = threads > 1 ? new ThreadPool(threads) : nullptr;
+	Huffman* coders = threads > 1 ? new Huffman[threads] : nullptr; // One per worker, so they don't share any state
+	for (int i = 0; i < threads && coders != nullptr; i++)
+	{
+		coders[i].maxCodeLength = maxCodeLength;
+		coders[i].streams = streams;
+		coders[i].histogramStride = histogramStride;
+	}
+
+	vector<HuffmanEstimate> parts(threads);
+	vector<ByteCounts> counts(threads);
+
+	readChunks(input, pool, [&](const unsigned char* chunk, size_t length, int worker)
+	{
+		Huffman& coder = coders == nullptr ? *this : coders[worker];
+		coder.estimateBlock(chunk, length, parts[worker], counts[worker].counts);
+	});
+
+	delete pool;
+	delete[] coders;
+
+	HuffmanEstimate estimate;
+	finishEstimate(estimate, parts, counts);
+
+	reportEstimate(estimate, start);
+
+	return estimate;
+}
+
+HuffmanEstimate Huffman::estimate(span<const unsigned char> input)
+{
+	/* [Public Method]
+	* Works out what encode would write for input, the same way estimateFile does for a file, on this thread
+	* and without printing anything.
+	*/
+
+	vector<HuffmanEstimate> parts(1);
+	vector<ByteCounts> counts(1);
+
+	for (size_t rawOffset = 0; rawOffset < input.size(); rawOffset += blockSize)
+	{
+		estimateBlock(input.data() + rawOffset, min(blockSize, input.size() - rawOffset), parts[0], counts[0].counts);
+	}
+
+	HuffmanEstimate estimate;
+	finishEstimate(estimate, parts, counts);
+
+	return estimate;
+}
+
+void Huffman::countChar(string inputFile)
+{
+/* [Private Method]
+*  Creates a FileReader for target file, which maps it into memory if it can.
+* 
+*  Resets charCounts[] and symbolCount, then has countInput count every byte of the file into them,
+*  on setThreads threads.
+* 
+*/
+
+	FileReader input(blockSize, useMapping);
+
+	if (!input.open(inputFile))
+	{
+		cout << "Unable to open file: " << inputFile << endl;
 		exit(0);
 		return;
 	}
 
-	string code = "";
-	unsigned char buffer[BUFF_SIZE]; // Written into from inputFile
-	unsigned char inBuffer[BUFF_SIZE]; // Buffer that will be written to outputFile
-	fill_n(inBuffer, BUFF_SIZE, 0);
-	fill_n(buffer, BUFF_SIZE, 0); // clear arrays before moving forward
-	int inBufferIndex = 0;
+	fill_n(charCounts, 256, 0); // Start from zero so the object can be reused for another file
+	symbolCount = 0;
+
+	ThreadPool* pool = threads > 1 ? new ThreadPool(threads) : nullptr;
+	countInput(input, pool);
+	delete pool;
+}
+
+void Huffman::countInput(FileReader& input, ThreadPool* pool)
+{
+	/* [Private Method]
+	* Adds the count of every byte left in input to charCounts[], and the number of bytes to symbolCount.
+	* input must read chunks of at most blockSize bytes.
+	*
+	* With a pool, readChunks hands each chunk to a worker, which counts it into a ByteCounts of its own,
+	* and those are added to charCounts[] once every chunk is done. Since each worker's counts sit on cache
+	* lines no other thread writes to, the workers never slow each other down, and counting speeds up with
+	* every core until memory can't keep up. Without one, the chunks are counted on this thread.
+	*/
 
-	while (!input.eof())
+	vector<ByteCounts> workerCounts(pool == nullptr ? 1 : pool->size());
+
+	STATS_START(countStart);
+
+	symbolCount += readChunks(input, pool, [&workerCounts](const unsigned char* chunk, size_t length, int worker)
 	{
-		input.read((char*)buffer, BUFF_SIZE); // reads 512 bytes from file into buffer array
-		unsigned char* p = buffer; // points to the first byte in the BUFF_SIZE byte buffer
-		if (input.gcount() == BUFF_SIZE)
-		{
-			for (int i = 0; i < BUFF_SIZE; i++) code += charCipher[*(p++)]; // Append char cipher of given byte to code, and move to next location in array
+		countBytes(chunk, length, workerCounts[worker].counts);
+	});
 
-			while (code.length() >= 8)
-			{
-				unsigned char c = 0;  // start with a byte of zeroes
-				if (code[0] == '1') c |= 0x80;
-				if (code[1] == '1') c |= 0x40;
-				if (code[2] == '1') c |= 0x20;
-				if (code[3] == '1') c |= 0x10;
-				if (code[4] == '1') c |= 0x08;
-				if (code[5] == '1') c |= 0x04;
-				if (code[6] == '1') c |= 0x02;
-				if (code[7] == '1') c |= 0x01;
-				inBuffer[inBufferIndex++] = c;
-
-				if (inBufferIndex == BUFF_SIZE) // If the buffer index is equal to the size, write the buffer to the file and reset index
-				{
-					output.write((char*)inBuffer, BUFF_SIZE); 
-					fill_n(inBuffer, BUFF_SIZE, 0);
-					inBufferIndex = 0;
-				}
+	for (ByteCounts& counts : workerCounts) for (int i = 0; i < 256; i++) charCounts[i] += counts.counts[i];
 
-				code = code.substr(8);
+	STATS_STOP(histogramNs, countStart);
+}
 
-			}
+unsigned long long Huffman::readChunks(FileReader& input, ThreadPool* pool, function<void(const unsigned char*, size_t, int)> task)
+{
+	/* [Private Method]
+	* Reads input chunk-by-chunk (each at most blockSize bytes) and calls task on each chunk with the index of
+	* the worker running it, or 0 without a pool. Returns the number of bytes read.
+	*
+	* With a pool, this thread only reads, and each chunk is submitted to a worker. A mapped file's chunks
+	* point straight into the mapping, so even its page faults are taken on the workers. Up to 2 * workers + 2
+	* chunks are out at once. When input isn't mapped, each has its own buffer, which is only read into
+	* again once the worker is done with it. Every task has finished by the time this returns.
+	*/
 
-		}
-		else
-		{
-			output.write((char*)inBuffer, inBufferIndex); // Write what is already in the input buffer to the file and clear it
-			fill_n(inBuffer, BUFF_SIZE, 0);
-			inBufferIndex = 0;
+	size_t slots = pool == nullptr ? 1 : 2 * pool->size() + 2;
+	vector<vector<unsigned char>> buffers(slots); // Only used when input isn't mapped
+	vector<future<void>> done(slots); // Ready once each slot's chunk has been handled
 
-			for (int i = 0; i < input.gcount(); i++) code += charCipher[*(p++)]; // Append char cipher of given byte to code, and move to next location in array
-			while (true)
-			{
-				unsigned char c = 0;  // start with a byte of zeroes
-				if (code[0] == '1') c |= 0x80;
-				if (code[1] == '1') c |= 0x40;
-				if (code[2] == '1') c |= 0x20;
-				if (code[3] == '1') c |= 0x10;
-				if (code[4] == '1') c |= 0x08;
-				if (code[5] == '1') c |= 0x04;
-				if (code[6] == '1') c |= 0x02;
-				if (code[7] == '1') c |= 0x01;
-				inBuffer[inBufferIndex] = c;
-
-				if (code.length() == 0) // If the code length is zero, the string has been processed: write the buffer to the file and reset index
-				{
-					output.write((char*)inBuffer, inBufferIndex); 
-					fill_n(inBuffer, BUFF_SIZE, 0);
-					break;
-				}
+	unsigned long long total = 0;
+	const unsigned char* chunk;
+	size_t length;
 
-				inBufferIndex++;
-				if (code.length() >= 8) code = code.substr(8);
-				else code = "";
+	for (size_t slot = 0; ; slot = (slot + 1) % slots)
+	{
+		if (done[slot].valid()) done[slot].get();
+		if (!input.isMapped()) buffers[slot].resize(blockSize);
 
-			}
-		}
+		length = input.next(chunk, buffers[slot].data());
+		if (length == 0) break;
+
+		total += length;
 
+		if (pool == nullptr) task(chunk, length, 0);
+		else done[slot] = pool->submit([chunk, length, &task](int worker) { task(chunk, length, worker); });
 	}
 
-	input.close();
-	output.close();
+	for (future<void>& slot : done) if (slot.valid()) slot.get();
+
+	return total;
+}
+
+int Huffman::popMinNode(int heap[], int& heapSize)
+{
+	/* [Private Method]
+	Removes and returns the node with the minimum weight from a binary min-heap of node indices.
+
+	Ties go to the node with the lower key, which is the same order the old linear scan over the
+	leaves array picked nodes in, so trees (and .htree files) come out the same as before.
+
+	*/
+
+	int target = heap[0];
+	int moving = heap[--heapSize]; // Last node in the heap gets sifted down from the top
+
+	int i = 0;
+	while (2 * i + 1 < heapSize)
+	{
+		int child = 2 * i + 1;
+		if (child + 1 < heapSize && nodeLess(heap[child + 1], heap[child])) child++; // Pick the smaller child
+		if (!nodeLess(heap[child], moving)) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = moving;
 
-	ifstream bytesIn(inputFile, ios::binary | ios::ate); // Finally, output elapsed time and bytes in/out to console
-	ifstream bytesOut(outputFile, ios::binary | ios::ate);
+	return target;
+
+}
+
+void Huffman::pushNode(int heap[], int& heapSize, int node)
+{
+	/* [Private Method]
+	Adds a node index to a binary min-heap, sifting it up to where it belongs.
+	*/
 
-	cout << bytesIn.tellg() << " bytes in / " << bytesOut.tellg() << " bytes out" << endl;
+	int i = heapSize++;
+	while (i > 0 && nodeLess(node, heap[(i - 1) / 2]))
+	{
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap[i] = node;
+}
 
-	bytesIn.close();
-	bytesOut.close();
+bool Huffman::nodeLess(int a, int b)
+{
+	/* [Private Method]
+	Orders nodes by weight, then by key.
+	*/
 
+	return nodes[a].weight < nodes[b].weight || (nodes[a].weight == nodes[b].weight && nodes[a].key < nodes[b].key);
 }
 
-void Huffman::tearDown(HNode* traverse)
+void Huffman::initTree(bool allBytes)
 {
-	/* [Private method]
-	*  used exclusivley by the destructor
-	*  Recursivley traverses through the tree and deletes each node
+	/* [Private Method]
+	 IMPORTANT: BEFORE CALLING MAKE SURE TO UPDATE THE CHAR COUNT ARRAY USING countChar()
+	
+	 Builds the tree that will be used to encode file by pairing nodes together. Lower weighted nodes will be paired first, and
+	 then heigher weighted nodes will get paired.
+
+	 The tree is built in nodes[]: the leaves are nodes[0-255] (indexed by their key), and each parent is placed after them.
+	 A binary heap keeps the unpaired nodes in order, so each pairing takes O(log n) instead of a scan over every leaf, and
+	 nothing is allocated.
+	
+	 If allBytes is true, all 256 leaves are paired (even ones with no weight), so there will be exactly 255 pairs made. Each pairing
+	 will be saved to pairOrder[], which is later used as a 510-byte tree-builder header. Otherwise only bytes that appear in the
+	 file are paired, which gives them shorter codes.
+
+	 Once built, root will be set to the index of the last node standing.
+	
 	*/
 
-	if (traverse->lPtr != nullptr) tearDown(traverse->lPtr);
-	if (traverse->rPtr != nullptr) tearDown(traverse->rPtr);
+	int heap[256]; // Unpaired nodes
+	int heapSize = 0;
+
+	for (int i = 0; i < 256; i++) // Set all leaf values
+	{
+		nodes[i].key = i;
+		nodes[i].left = -1;
+		nodes[i].right = -1;
+		nodes[i].weight = charCounts[i];
+
+		if (allBytes || charCounts[i] > 0) pushNode(heap, heapSize, i);
+	}
+
+	nodeCount = 256;
+	int pairIndex = 0;
+
+	while (heapSize > 1) // Build tree
+	{
+		int min = popMinNode(heap, heapSize); // gets least weighted node (Biased towards lower keys)
+		int secondMin = popMinNode(heap, heapSize); // gets second least weighted node
+
+		int lower = nodes[min].key < nodes[secondMin].key ? min : secondMin; // lower keyed nodes go to the left...
+		int higher = lower == min ? secondMin : min; // ... And higher keyed nodes go to the right
 
-	delete traverse; // When both pointers are null, node is a leaf, so delete it.
+		if (allBytes)
+		{
+			pairOrder[pairIndex++] = nodes[lower].key;
+			pairOrder[pairIndex++] = nodes[higher].key;
+		}
+
+		HNode& parent = nodes[nodeCount]; // create new parent node
+		parent.weight = nodes[min].weight + nodes[secondMin].weight; // parent node's weight will be equal to the sum of it's children
+		parent.left = lower;
+		parent.right = higher;
+		parent.key = nodes[lower].key; // The parent will inheret its left-childs key. (This is used to break ties the same way every time)
+
+		pushNode(heap, heapSize, nodeCount++);
+	}
+
+	root = heapSize == 1 ? heap[0] : -1; // Set the root node as the final node in the heap (No root if the file was empty)
+
+}
 
-}
\ No newline at end of file
+bool Huffman::rebuildTree(string inputFile)
+{
+	/* [Private Method]
+	 IMPORTANT: MAKE SURE TO CALL rebuildPairOrder() BEFORE CALLING
+	
+	 Reuilds the tree that will be used to decode file by pairing nodes together.
+
+	 Once built, root will be set to the index of the proper node. Returns false if pairOrder[] doesn't
+	 make a tree (the header is corrupt).
+
+	 Functionally similar to initTree, however this method gets the order to pair nodes from the pairOrder array.
+	 slot[] keeps track of which node each key currently belongs to.
+	*/
+
+	int slot[256];
+
+	for (int i = 0; i < 256; i++) // Set all leaf values
+	{
+		nodes[i].key = i;
+		nodes[i].left = -1;
+		nodes[i].right = -1;
+		nodes[i].weight = 0;
+		slot[i] = i;
+	}
+
+	nodeCount = 256;
+	int pairIndex = 0;
+
+	for (int i = 0; i < 255; i++) // Build tree
+	{
+		int min = slot[pairOrder[pairIndex++]];
+		int secondMin = slot[pairOrder[pairIndex++]];
+
+		if (min < 0 || secondMin < 0 || min == secondMin) // Pairs a node that is already inside another one
+		{
+			cout << "Corrupt file header" << endl;
+			return false;
+		}
+
+		int lower = nodes[min].key < nodes[secondMin].key ? min : secondMin; // lower keyed nodes go to the left...
+		int higher = lower == min ? secondMin : min; // ... And higher keyed nodes go to the right
+
+		HNode& parent = nodes[nodeCount]; // create new parent node
+		parent.left = lower;
+		parent.right = higher;
+		parent.key = nodes[lower].key; // The parent will inheret its left-childs key. (This is used to keep track of where it will end up in the array)
+		parent.weight = 0;
+
+		slot[nodes[lower].key] = nodeCount++;
+		slot[nodes[higher].key] = -1;
+	}
+
+	root = slot[0]; // Set root of tree to last standing node
+
+	return true;
+}
+
+void Huffman::rebuildPairOrder(string inputFile)
+{
+	/* [Private Method]
+	* 
+	* Crawls through the first 510
+	* bytes from a target file and
+	* puts it in pairOrder[].
+	*/
+
+	ifstream input(inputFile, ios::binary);
+	unsigned char c; // will be used to hold byte at indexed location in for loop
+
+	if (!input.is_open())
+	{
+		cout << "Unable to open file: " << inputFile << endl;
+		exit(0);
+		return;
+	}
+
+	for (int i = 0; i < 510; i++)
+	{
+		input.read((char*)&c,sizeof(c));
+		pairOrder[i] = c; // Writes the 510-byte header to the output file
+
+	}
+
+	input.close();
+}
+
+void Huffman::buildCipher(int node, int depth)
+{
+/* [Private Method]
+ Recursivley traverses the tree, keeping track of the path taken in cipherPath[] (one bit per level, left-aligned).
+ Once the method hits a leaf, it stores the length of the path into cipherLength[key] and the path itself
+ into cipherCode[key] (right-aligned) or, for paths over 32 bits, into longCipher[key].
+ Leaves with a weight also get their length saved into codeLengths[] for canonical files.
+ More common characters will have shorter paths, while rarer characters will have longer paths.
+*/
+	if (node == -1) // If node is -1, then this method is being called directly
+	{
+		fill_n(codeLengths, 256, 0);
+		if (root == -1) return; // Empty file, no codes to give out
+		node = root;
+	}
+
+	const HNode& traverse = nodes[node];
+	unsigned long long bit = 1ULL << (63 - depth % 64); // Position of this level's bit in cipherPath[]
+
+	if (traverse.left != -1)
+	{
+		cipherPath[depth / 64] &= ~bit;
+		buildCipher(traverse.left, depth + 1);
+	}
+
+	if (traverse.right != -1)
+	{
+		cipherPath[depth / 64] |= bit;
+		buildCipher(traverse.right, depth + 1);
+	}
+
+	// When both children are -1, node is a leaf
+
+	if (traverse.right == -1 && traverse.left == -1)
+	{
+		if (depth == 0) // Only one byte appears in the file, it still needs a 1-bit code
+		{
+			depth = 1;
+			cipherPath[0] = 0;
+		}
+
+		cipherLength[traverse.key] = depth;
+		codeLengths[traverse.key] = traverse.weight > 0 ? depth : 0; // Only bytes that appear get a code in canonical files
+
+		if (depth <= 32) cipherCode[traverse.key] = (unsigned int)((cipherPath[0] >> 32) >> (32 - depth));
+		else for (int i = 0; i < 4; i++) longCipher[traverse.key][i] = cipherPath[i];
+	}
+
+}
+
+void Huffman::assignCanonicalCodes()
+{
+	/* [Private Method]
+	* IMPORTANT: MAKE SURE codeLengths[] HAS BEEN FILLED BEFORE CALLING
+	*
+	* Gives every byte with a code length a canonical code of that length. Shorter codes come first,
+	* and codes of the same length count up in byte order, so the codes can be rebuilt from
+	* codeLengths[] alone. The codes are placed into cipherCode[]/longCipher[] for writeCodeToFile.
+	*/
+
+	int lengthCount[MAX_CODE_LENGTH + 1]; // Number of codes of each length
+	fill_n(lengthCount, MAX_CODE_LENGTH + 1, 0);
+	for (int i = 0; i < 256; i++) lengthCount[codeLengths[i]]++;
+	lengthCount[0] = 0;
+
+	unsigned long long nextCode[MAX_CODE_LENGTH + 1]; // First unused code of each length
+	unsigned long long code = 0;
+	for (int length = 1; length <= MAX_CODE_LENGTH; length++)
+	{
+		code = (code + lengthCount[length - 1]) << 1;
+		nextCode[length] = code;
+	}
+
+	for (int i = 0; i < 256; i++)
+	{
+		int length = codeLengths[i];
+		cipherLength[i] = length;
+		if (length == 0) continue;
+
+		code = nextCode[length]++;
+		if (length <= 32) cipherCode[i] = (unsigned int)code;
+		else
+		{
+			longCipher[i][0] = code << (64 - length);
+			longCipher[i][1] = longCipher[i][2] = longCipher[i][3] = 0;
+		}
+	}
+}
+
+void Huffman::setMaxCodeLength(int maxLength)
+{
+	/* [Public Method]
+	* Sets the longest code encodeFile is allowed to give a byte. A limit of DECODE_BITS (11) or less lets
+	* every code be resolved by a single decode table lookup, at a small cost in compression. Longer codes
+	* finish with a walk down the tree after the lookup.
+	* Limits too small to give all 256 bytes a code are raised to 8.
+	*/
+
+	if (maxLength < 8) maxLength = 8;
+	if (maxLength > MAX_CODE_LENGTH) maxLength = MAX_CODE_LENGTH;
+	maxCodeLength = maxLength;
+}
+
+void Huffman::setBlockSize(size_t size)
+{
+	/* [Public Method]
+	* Sets how many bytes of the input go in each block encodeFile writes. Bigger blocks spread the
+	* cost of each block's length table over more bytes, smaller ones adapt to changes in the file
+	* faster and give the threads more pieces to work on. Kept between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE.
+	*/
+
+	if (size < MIN_BLOCK_SIZE) size = MIN_BLOCK_SIZE;
+	if (size > MAX_BLOCK_SIZE) size = MAX_BLOCK_SIZE;
+	blockSize = size;
+}
+
+void Huffman::setThreads(int count)
+{
+	/* [Public Method]
+	* Sets how many threads encodeFile uses to encode blocks, and decodeFile uses to decode them.
+	*/
+
+	threads = count < 1 ? 1 : count;
+}
+
+void Huffman::setStreams(int count)
+{
+	/* [Public Method]
+	* Sets how many interleaved substreams each block encodeFile writes is split into: 1, or BLOCK_STREAMS
+	* so a single thread can decode several streams at once (see decodeStreams). Costs a few bytes per block.
+	* Anything else is treated as 1.
+	*/
+
+	streams = count == BLOCK_STREAMS ? BLOCK_STREAMS : 1;
+}
+
+void Huffman::setContextTables(int count)
+{
+	/* [Public Method]
+	* Lets encodeFile code each byte with a table picked by the byte before it, using up to count tables
+	* (at most CONTEXT_MAX_TABLES). Blocks only use it when it comes out smaller than one table would.
+	* 0 or 1 turns it off.
+	*/
+
+	contextTables = count < 2 ? 0 : min(count, CONTEXT_MAX_TABLES);
+}
+
+void Huffman::setHistogramStride(size_t stride)
+{
+	/* [Public Method]
+	* Sets how much of each block encodeFile counts before building its codes: 1 in every stride runs of
+	* HISTOGRAM_SAMPLE_RUN bytes (see sampleBytes), or every byte for a stride of 1, the default. Counting
+	* less is faster, but the codes only fit the sample, so the output usually comes out a little bigger.
+	* Blocks too small to give a sample of HISTOGRAM_SAMPLE_MIN bytes are counted in full. 0 is treated as 1.
+	* The pair counts setContextTables needs are never sampled, so the two don't save anything together.
+	*/
+
+	histogramStride = stride < 1 ? 1 : stride;
+}
+
+void Huffman::setMemoryMapping(bool enabled)
+{
+	/* [Public Method]
+	* Sets whether files may be memory mapped. When disabled (or when a file can't be mapped, like a pipe),
+	* files are read and written through streams instead.
+	*/
+
+	useMapping = enabled;
+}
+
+void Huffman::setStatsJson(bool enabled)
+{
+	/* [Public Method]
+	* Sets whether the summary printed after each file is a line of JSON (see writeStatsJson) instead of
+	* the usual "seconds, bytes in / bytes out" line. With JSON, encodeStream and decodeStream print it to cerr.
+	*/
+
+	jsonStats = enabled;
+}
+
+const HuffmanStats& Huffman::getStats()
+{
+	/* [Public Method]
+	* Counters from the last file or buffer encoded or decoded.
+	*/
+
+	return stats;
+}
+
+void Huffman::report(string mode, std::chrono::steady_clock::time_point start, ostream& console)
+{
+	/* [Private Method]
+	* Prints the summary of what was just done to console: elapsed time and the bytes in/out counted along
+	* the way (and the number of files, for a batch), or all of stats as JSON if setStatsJson was turned on.
+	* Prints nothing if quiet is set.
+	*/
+
+	if (quiet) return;
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (jsonStats) writeStatsJson(console, stats, mode, seconds);
+	else if (stats.files != 1) console << stats.files << " files, " << fixed << setprecision(3) << seconds << " seconds. " << stats.bytesIn << " bytes in / " << stats.bytesOut << " bytes out" << endl;
+	else console << fixed << setprecision(3) << seconds << " seconds. " << stats.bytesIn << " bytes in / " << stats.bytesOut << " bytes out" << endl;
+}
+
+void Huffman::limitCodeLengths(int limit)
+{
+	/* [Private Method]
+	* IMPORTANT: MAKE SURE THAT countChar() AND buildCipher() HAVE BEEN CALLED BEFORE CALLING
+	*
+	* If the longest code in codeLengths[] is over limit, rebuilds codeLengths[] from charCounts[]
+	* using package-merge, which finds the best lengths possible that are all limit or under.
+	*
+	* The bytes are sorted by weight. At each of the limit levels, the items of the previous level
+	* are paired up (in order) into packages, which are merged back in with the bytes by weight. The first
+	* 2n-2 items of the last level are kept. Every package kept means its two items from the level below are
+	* kept too, and each byte's code length is the number of levels it was kept at.
+	*
+	* Adds the size of the encoded bits with and without the limit to unlimitedBits and limitedBits, so the
+	* cost can be reported.
+	*/
+
+	int symbols[256]; // Bytes that appear, sorted by weight
+	int n = 0;
+	int longest = 0;
+
+	for (int i = 0; i < 256; i++)
+	{
+		if (codeLengths[i] == 0) continue;
+		symbols[n++] = i;
+		if (codeLengths[i] > longest) longest = codeLengths[i];
+	}
+
+	if (longest <= limit) return; // Huffman codes already fit
+
+	sort(symbols, symbols + n, [this](int a, int b) { return charCounts[a] < charCounts[b] || (charCounts[a] == charCounts[b] && a < b); });
+
+	struct PackageItem
+	{
+		unsigned long long weight;
+		int symbol; // Byte this item stands for, or -1 for a package of two items from the level below
+	};
+
+	vector<vector<PackageItem>> levels(limit);
+
+	for (int level = 0; level < limit; level++)
+	{
+		vector<PackageItem>& items = levels[level];
+		items.reserve(2 * n);
+
+		int leaf = 0;
+		size_t pair = 0;
+		size_t pairCount = level == 0 ? 0 : levels[level - 1].size() / 2;
+
+		while (leaf < n || pair < pairCount) // Merge the bytes and the packages made from the level below by weight
+		{
+			unsigned long long packageWeight = 0;
+			if (pair < pairCount) packageWeight = levels[level - 1][2 * pair].weight + levels[level - 1][2 * pair + 1].weight;
+
+			if (pair == pairCount || (leaf < n && charCounts[symbols[leaf]] <= packageWeight))
+			{
+				items.push_back({ charCounts[symbols[leaf]], symbols[leaf] });
+				leaf++;
+			}
+			else
+			{
+				items.push_back({ packageWeight, -1 });
+				pair++;
+			}
+		}
+	}
+
+	for (int i = 0; i < 256; i++)
+	{
+		unlimitedBits += charCounts[i] * codeLengths[i];
+		codeLengths[i] = 0;
+	}
+
+	size_t keep = 2 * n - 2; // Number of items kept at the current level
+
+	for (int level = limit - 1; level >= 0 && keep > 0; level--)
+	{
+		size_t packages = 0;
+		for (size_t i = 0; i < keep; i++)
+		{
+			if (levels[level][i].symbol >= 0) codeLengths[levels[level][i].symbol]++;
+			else packages++;
+		}
+		keep = 2 * packages;
+	}
+
+	for (int i = 0; i < 256; i++) limitedBits += charCounts[i] * codeLengths[i];
+}
+
+int Huffman::writeLengthTable(unsigned char* out)
+{
+	/* [Private Method]
+	* Writes codeLengths[] to out, and returns the number of bytes written (at most LENGTH_TABLE_SIZE):
+	*
+	*	number of bytes with a code - 1
+	*	up to 32 bytes with a code: the bytes themselves, otherwise a 32-byte bitmap of them
+	*	length of the longest code
+	*	code lengths in byte order, two per byte (high nibble first) if they all fit in 4 bits, else one per byte
+	*
+	* At least one byte must have a code.
+	*/
+
+	int size = 0;
+	int present = 0;
+	int maxLength = 0;
+
+	for (int i = 0; i < 256; i++)
+	{
+		if (codeLengths[i] == 0) continue;
+		present++;
+		if (codeLengths[i] > maxLength) maxLength = codeLengths[i];
+	}
+
+	out[size++] = present - 1;
+
+	if (present <= 32) // List the bytes directly
+	{
+		for (int i = 0; i < 256; i++) if (codeLengths[i] != 0) out[size++] = i;
+	}
+	else // Bitmap of which bytes have a code
+	{
+		fill_n(out + size, 32, 0);
+		for (int i = 0; i < 256; i++) if (codeLengths[i] != 0) out[size + i / 8] |= 1 << (i % 8);
+		size += 32;
+	}
+
+	out[size++] = maxLength;
+
+	int count = 0;
+	for (int i = 0; i < 256; i++)
+	{
+		if (codeLengths[i] == 0) continue;
+
+		if (maxLength > 15) out[size++] = codeLengths[i];
+		else if (count++ % 2 == 0) out[size++] = codeLengths[i] << 4;
+		else out[size - 1] |= codeLengths[i];
+	}
+
+	return size;
+}
+
+int Huffman::readLengthTable(const unsigned char* in, size_t available)
+{
+	/* [Private Method]
+	* Reads a table written by writeLengthTable into codeLengths[], and returns the number of bytes it took up.
+	*
+	* Returns -1 if the table runs past available, or if the lengths can't belong to a prefix code
+	* (checked with the Kraft inequality, so a bad table can't overflow the decoder's arrays).
+	*/
+
+	fill_n(codeLengths, 256, 0);
+
+	size_t size = 0;
+	unsigned char symbols[256];
+
+	if (available < 1) return -1;
+	int present = in[size++] + 1;
+
+	if (present <= 32)
+	{
+		if (available < size + present) return -1;
+		for (int i = 0; i < present; i++) symbols[i] = in[size++];
+	}
+	else
+	{
+		if (available < size + 32) return -1;
+		int count = 0;
+		for (int i = 0; i < 256; i++) if (in[size + i / 8] & (1 << (i % 8))) symbols[count++] = i;
+		if (count != present) return -1;
+		size += 32;
+	}
+
+	if (available < size + 1) return -1;
+	int maxLength = in[size++];
+	if (maxLength == 0 || maxLength > MAX_CODE_LENGTH) return -1;
+
+	size_t lengthBytes = maxLength > 15 ? present : (present + 1) / 2;
+	if (available < size + lengthBytes) return -1;
+
+	for (int i = 0; i < present; i++)
+	{
+		if (maxLength > 15) codeLengths[symbols[i]] = in[size + i];
+		else if (i % 2 == 0) codeLengths[symbols[i]] = in[size + i / 2] >> 4;
+		else codeLengths[symbols[i]] = in[size + i / 2] & 0x0F;
+	}
+	size += lengthBytes;
+
+	unsigned long long kraft = 0; // Sum of 2^(MAX_CODE_LENGTH - length), which can't go past 2^MAX_CODE_LENGTH for a valid code
+	for (int i = 0; i < present; i++)
+	{
+		int length = codeLengths[symbols[i]];
+		if (length == 0 || length > maxLength) return -1;
+		kraft += 1ULL << (MAX_CODE_LENGTH - length);
+	}
+	if (kraft > (1ULL << MAX_CODE_LENGTH)) return -1;
+
+	return (int)size;
+}
+
+int Huffman::readHeader(istream& input, ostream& messages)
+{
+	/* [Private Method]
+	* Checks which format input is in, and returns its version:
+	*
+	*	LEGACY_FORMAT - no "HF" at the start, so it is a legacy file with a 510-byte pairOrder header.
+	*					Legacy headers always start with two increasing bytes, so "HF" can never be mistaken for one.
+	*					input is rewound to the start.
+	*	STREAM_FORMAT - "HF", 2, the number of bytes in the file (8 bytes, little endian) and a length table
+	*					if that is more than 0. These are read into symbolCount and codeLengths[].
+	*	BLOCK_FORMAT  - "HF", 3 and the block size (4 bytes, little endian), read into fileBlockSize.
+	*
+	* input is left at the first byte after the header. Returns -1, after saying why on messages, if input
+	* starts with "HF" but the rest of its header is damaged or from an unknown version.
+	*/
+
+	unsigned char magic[3] = { 0, 0, 0 };
+	input.read((char*)magic, 3);
+
+	if (input.gcount() < 2 || magic[0] != 'H' || magic[1] != 'F')
+	{
+		input.clear();
+		input.seekg(0);
+		return LEGACY_FORMAT;
+	}
+
+	unsigned char buffer[LENGTH_TABLE_SIZE];
+
+	if (input.gcount() == 3 && magic[2] == BLOCK_FORMAT)
+	{
+		input.read((char*)buffer, 4);
+		fileBlockSize = 0;
+		for (int i = 0; i < 4; i++) fileBlockSize |= (size_t)buffer[i] << (8 * i);
+
+		if (input.gcount() < 4 || fileBlockSize == 0 || fileBlockSize > MAX_BLOCK_SIZE)
+		{
+			messages << "Corrupt file header" << endl;
+			return -1;
+		}
+		return BLOCK_FORMAT;
+	}
+
+	if (input.gcount() < 3 || magic[2] != STREAM_FORMAT)
+	{
+		messages << "Unsupported file version" << endl;
+		return -1;
+	}
+
+	input.read((char*)buffer, 8);
+	symbolCount = 0;
+	for (int i = 0; i < 8; i++) symbolCount |= (unsigned long long)buffer[i] << (8 * i);
+
+	fill_n(codeLengths, 256, 0);
+	if (symbolCount == 0) return STREAM_FORMAT;
+
+	streampos tableStart = input.tellg();
+	input.read((char*)buffer, LENGTH_TABLE_SIZE); // The table is at most this long, read what is there and go back to its end
+	int tableSize = readLengthTable(buffer, input.gcount());
+
+	if (tableSize < 0)
+	{
+		messages << "Corrupt file header" << endl;
+		return -1;
+	}
+
+	input.clear();
+	input.seekg(tableStart + (streamoff)tableSize);
+
+	return STREAM_FORMAT;
+}
+
+void Huffman::compileDecoderFromLengths()
+{
+	/* [Private Method]
+	* IMPORTANT: MAKE SURE readLengthTable() HAS FILLED codeLengths[] BEFORE CALLING
+	*
+	* Rebuilds the canonical codes from codeLengths[] and inserts each one into decodeNodes[], then fills
+	* decodeTable[] from it the same way compileDecoder does for a tree. No HNodes are created.
+	* Paths that no code uses decode as byte 0, they can't appear in a valid file.
+	*/
+
+	assignCanonicalCodes();
+
+	int flatCount = 1;
+	decodeNodes[0][0] = decodeNodes[0][1] = 0; // 0 marks a missing child while building, since the root can never be a child
+
+	for (int i = 0; i < 256; i++)
+	{
+		int length = codeLengths[i];
+		if (length == 0) continue;
+
+		unsigned long long code = length <= 32 ? (unsigned long long)cipherCode[i] << (64 - length) : longCipher[i][0]; // left-aligned code
+		int node = 0;
+
+		for (int depth = 1; depth < length; depth++, code <<= 1)
+		{
+			short& child = decodeNodes[node][code >> 63];
+			if (child == 0)
+			{
+				child = flatCount;
+				decodeNodes[flatCount][0] = decodeNodes[flatCount][1] = 0;
+				flatCount++;
+			}
+			node = child;
+		}
+
+		decodeNodes[node][code >> 63] = ~i;
+	}
+
+	for (int i = 0; i < flatCount; i++) // Point missing children at a leaf
+	{
+		if (decodeNodes[i][0] == 0) decodeNodes[i][0] = ~0;
+		if (decodeNodes[i][1] == 0) decodeNodes[i][1] = ~0;
+	}
+
+	fillDecodeTable(0, 0, 0);
+}
+
+void Huffman::compileDecoder()
+{
+	/* [Private Method]
+	* IMPORTANT: MAKE SURE THE TREE HAS BEEN BUILT BEFORE CALLING
+	*
+	* Flattens the tree into decodeNodes[] (the root ends up at index 0), then fills decodeTable[] so that
+	* the next DECODE_BITS bits of the stream can be used as an index to find the next byte and its code length.
+	* Codes longer than DECODE_BITS get an entry pointing at the node reached after DECODE_BITS bits, and
+	* the decoder finishes walking those from there.
+	*/
+
+	int flatCount = 0;
+	flattenTree(root, flatCount);
+	fillDecodeTable(0, 0, 0);
+}
+
+int Huffman::flattenTree(int node, int& flatCount)
+{
+	/* [Private Method]
+	* Recursivley copies the internal nodes under node into decodeNodes[] in pre-order.
+	* Leaves are not given a slot, their parent stores ~key in place of a child index instead.
+	*/
+
+	int index = flatCount++;
+	const HNode& traverse = nodes[node];
+
+	if (nodes[traverse.left].left == -1) decodeNodes[index][0] = ~nodes[traverse.left].key; // Left child is a leaf
+	else decodeNodes[index][0] = flattenTree(traverse.left, flatCount);
+
+	if (nodes[traverse.right].left == -1) decodeNodes[index][1] = ~nodes[traverse.right].key; // Right child is a leaf
+	else decodeNodes[index][1] = flattenTree(traverse.right, flatCount);
+
+	return index;
+}
+
+void Huffman::fillDecodeTable(int node, int depth, unsigned int prefix)
+{
+	/* [Private Method]
+	* Recursivley walks decodeNodes[] from node, where prefix holds the depth bits it took to get there.
+	* Once a leaf is hit, every table entry starting with that path is set to the leaf's key, since the
+	* bits after the code belong to the next one. Paths that reach DECODE_BITS without hitting a leaf
+	* store the node they stopped at.
+	*/
+
+	for (int bit = 0; bit < 2; bit++)
+	{
+		int child = decodeNodes[node][bit];
+		unsigned int path = (prefix << 1) | bit;
+		int length = depth + 1;
+
+		if (child < 0) // Leaf, fill every entry that begins with this path
+		{
+			unsigned int first = path << (DECODE_BITS - length);
+			unsigned int last = (path + 1) << (DECODE_BITS - length);
+			for (unsigned int i = first; i < last; i++)
+			{
+				decodeTable[i].symbol = (unsigned char)~child;
+				decodeTable[i].length = length;
+			}
+		}
+		else if (length == DECODE_BITS) // Code is longer than the table, remember where to keep walking from
+		{
+			decodeTable[path].symbol = child;
+			decodeTable[path].length = 0;
+		}
+		else fillDecodeTable(child, length, path);
+	}
+}
+
+void Huffman::writeCodeToFile(string inputFile, string outputFile)
+{
+	/* [Private Method]
+	*  
+	* == IMPRORTANT, MAKE SURE THAT countChar(), initTree(), & buildCipher() BEEN CALLED
+	* BEFORE CALLING THIS METHOD TO INITIALIZE ALL RELEVANT ARRAYS AND THE TREE ==============
+	* 
+	* Using the cipher arrays generated by buildCipher, this method parses through inputFile and generates
+	* a bit string to be placed into outputFile, after the 510-byte pairOrder header. Each code is shifted into
+	* a BitWriter, which moves whole 32-bit words into a large output buffer. If the bit string is not divisible
+	* by 8, up to 7 padding 0s will be present at the end of the file. Because the decoder works by traversing
+	* down the tree until it finds a node, these bits will be discarded and not effect the decoding.
+	*/
+
+	if (outputFile == "") // If outputFile is not specified, set its name to the input file w/ extension .huf
+	{
+		size_t last = inputFile.find_last_of('.');
+		outputFile = inputFile.substr(0, last);
+		outputFile += ".huf";
+	}
+	else if (outputFile.find('.') == string::npos) // This happens when the user specifies a file name but not an extension
+	{
+		outputFile += ".huf";
+	}
+
+	FileReader input(CODER_BUFF_SIZE, useMapping);
+	bool opened = input.open(inputFile);
+	ofstream output(outputFile, ios::binary);
+
+	output.write((char*)pairOrder, 510); // Writes the 510-byte header to the output file
+
+	if (!opened)
+	{
+		cout << "Unable to open file: " << inputFile << endl; // File does not exist, so alert the user and exit
+		exit(0);
+		return;
+	}
+
+	unsigned char* inBuffer = new unsigned char[CODER_BUFF_SIZE]; // Written into from inputFile if it isn't mapped
+	unsigned char* outBuffer = new unsigned char[CODER_BUFF_SIZE + 40]; // Buffer that will be written to outputFile (with room for one more code)
+
+	BitWriter writer;
+	writer.out = outBuffer;
+
+	const unsigned char* chunk;
+	size_t length;
+
+	stats.bytesOut = 510;
+	STATS_ADD(blocks, 1);
+
+	while ((length = input.next(chunk, inBuffer)) > 0)
+	{
+		stats.bytesIn += length;
+		STATS_START(codingStart);
+
+		for (size_t i = 0; i < length; i++)
+		{
+			unsigned char c = chunk[i];
+
+			if (cipherLength[c] <= 32) writer.put(cipherCode[c], cipherLength[c]); // Common case, the whole code fits in the bit buffer at once
+			else writer.putLong(longCipher[c], cipherLength[c]); // Long codes are shifted in 32 bits at a time
+
+			if (writer.out - outBuffer >= CODER_BUFF_SIZE) // If the buffer is full, write it to the file and reset it
+			{
+				output.write((char*)outBuffer, writer.out - outBuffer);
+				stats.bytesOut += writer.out - outBuffer;
+				writer.out = outBuffer;
+			}
+		}
+
+		STATS_STOP(codingNs, codingStart);
+#ifndef HUFFMAN_NO_STATS
+		countBytes(chunk, length, stats.byteCounts); // The entropy needs the file's own counts, not the tree file's
+#endif
+	}
+
+	writer.finish();
+	output.write((char*)outBuffer, writer.out - outBuffer);
+	stats.bytesOut += writer.out - outBuffer;
+	for (int i = 0; i < 256; i++) STATS_MAX(maxCodeLength, cipherLength[i]);
+
+	delete[] inBuffer;
+	delete[] outBuffer;
+
+	output.close();
+
+}
+
+unsigned long long Huffman::encodeBlock(const unsigned char* data, size_t length, vector<unsigned char>& out)
+{
+	/* [Private Method]
+	* Encodes length bytes of data as one block record, which is appended to out:
+	*
+	*	raw length (4 bytes, little endian)
+	*	block type (BLOCK_HUFFMAN, or BLOCK_HUFFMAN4 if setStreams(4) was called)
+	*	payload length (4 bytes, little endian)
+	*	payload: a length table (see writeLengthTable), then the encoded bits padded to a whole byte
+	*
+	* A BLOCK_HUFFMAN4 block splits data into BLOCK_STREAMS runs of (length + 3) / 4 bytes (the last gets
+	* what's left), and encodes each as its own bitstream with the same codes. After the length table comes
+	* a jump table with the byte length of every stream but the last (4 bytes each, little endian), then
+	* the streams back to back, each padded to a whole byte. This lets decodeStreams decode them in lockstep.
+	*
+	* The block gets its own counts, tree and canonical codes. Codes are limited to BLOCK_MAX_CODE_LENGTH
+	* bits so every code fits the encoder's bit buffer in one go. Since the code lengths are known before
+	* encoding, the exact size of the record is too, so out is only resized once.
+	*
+	* With setHistogramStride, the counts are estimated from a sample of the block instead (see sampleBytes),
+	* scaled up to its length, and bytes the sample missed get a count of 1 so they still have a code. The
+	* record's size then isn't known until it's written, and writeSampledRecord writes it instead.
+	*
+	* With setContextTables, encodeContextBlock gets the first try, and writes a BLOCK_CONTEXT record if
+	* conditioning on the previous byte pays for its bigger header.
+	*
+	* Blocks huffman codes can't help are handed to storeBlock instead: a block of one repeated byte becomes
+	* a BLOCK_RLE record, and a block that wouldn't get any smaller becomes a BLOCK_STORED copy. The entropy
+	* of the counts is a lower bound on the encoded size, so random or already compressed data is caught
+	* before any tree is built. Anything that gets past that and still comes out no smaller is stored too.
+	*
+	* Returns the length of the encoded bits, not counting the padding.
+	*/
+
+	int streamCount = streams; // Substreams in this block
+	size_t segment = (length + streamCount - 1) / streamCount; // Bytes in each one, the last gets what's left
+	unsigned long long streamCounts[BLOCK_STREAMS][256]; // charCounts of each substream, to size them before encoding
+	size_t sampleLength; // Bytes the counts came from
+
+	bool oneValue = countBlock(data, length, streamCounts, sampleLength);
+	bool sampled = sampleLength < length; // Codes come from a sample of the block
+
+	STATS_ADD(blocks, 1);
+	for (int i = 0; i < 256; i++) STATS_ADD(byteCounts[i], charCounts[i]);
+
+	if (oneValue) return storeBlock(data, length, BLOCK_RLE, out); // Only one byte value, nothing to code
+
+	int present;
+	double entropyBits = entropyBound(length, sampleLength, present); // Fewest bits any code for these counts could take
+	size_t tableBytes = (present <= 32 ? 2 + present : 34) + (present + 1) / 2; // Smallest the length table could be (see writeLengthTable)
+
+	unsigned long long contextBits;
+	if (contextTables > 1 && encodeContextBlock(data, length, out, entropyBits + 8.0 * tableBytes, contextBits)) return contextBits;
+
+	if (entropyBits / 8 + tableBytes >= length) return storeBlock(data, length, BLOCK_STORED, out); // Huffman codes can't make it any smaller
+
+	STATS_START(treeStart);
+	initTree(); // Builds tree based on char weights
+	STATS_STOP(treeNs, treeStart);
+
+	STATS_START(tableStart);
+	buildCipher(); // Gets the code length of every byte that appears in the block
+	limitCodeLengths(min(maxCodeLength, BLOCK_MAX_CODE_LENGTH)); // Shortens the longest codes if any are over the limit
+	assignCanonicalCodes(); // Replaces the tree's paths with canonical codes of the same lengths
+	STATS_STOP(tableNs, tableStart);
+
+	for (int i = 0; i < 256; i++) STATS_MAX(maxCodeLength, codeLengths[i]);
+
+	unsigned char table[LENGTH_TABLE_SIZE];
+	int tableSize = writeLengthTable(table);
+
+	if (sampled) return writeSampledRecord(data, length, table, tableSize, out);
+
+	unsigned long long bits = 0;
+	unsigned long long streamBits[BLOCK_STREAMS] = { 0 };
+	size_t streamsSize = 0; // Bytes taken by the jump table and the padded streams
+
+	if (streamCount == 1)
+	{
+		for (int i = 0; i < 256; i++) bits += charCounts[i] * codeLengths[i];
+		streamsSize = (bits + 7) / 8;
+	}
+	else
+	{
+		streamsSize = 4 * (streamCount - 1);
+		for (int s = 0; s < streamCount; s++)
+		{
+			for (int i = 0; i < 256; i++) streamBits[s] += streamCounts[s][i] * codeLengths[i];
+			bits += streamBits[s];
+			streamsSize += (streamBits[s] + 7) / 8;
+		}
+	}
+
+	size_t payloadLength = tableSize + streamsSize;
+
+	if (payloadLength >= length) return storeBlock(data, length, BLOCK_STORED, out); // The length table ate up what the codes saved
+
+	size_t start = out.size();
+	out.resize(start + BLOCK_HEADER_SIZE + payloadLength);
+	unsigned char* record = out.data() + start;
+
+	for (int i = 0; i < 4; i++) record[i] = (unsigned char)(length >> (8 * i));
+	record[4] = streamCount == 1 ? BLOCK_HUFFMAN : BLOCK_HUFFMAN4;
+	for (int i = 0; i < 4; i++) record[5 + i] = (unsigned char)(payloadLength >> (8 * i));
+	copy(table, table + tableSize, record + BLOCK_HEADER_SIZE);
+
+	STATS_START(codingStart);
+
+	BitWriter writer;
+	writer.out = record + BLOCK_HEADER_SIZE + tableSize;
+
+	if (streamCount == 1)
+	{
+		for (size_t i = 0; i < length; i++) writer.put(cipherCode[data[i]], cipherLength[data[i]]);
+		writer.finish();
+	}
+	else
+	{
+		unsigned char* jump = writer.out;
+		writer.out += 4 * (streamCount - 1);
+
+		for (int s = 0; s < streamCount; s++)
+		{
+			size_t streamLength = (streamBits[s] + 7) / 8;
+			for (int i = 0; i < 4 && s < streamCount - 1; i++) jump[4 * s + i] = (unsigned char)(streamLength >> (8 * i));
+
+			size_t end = min(length, (s + 1) * segment);
+			for (size_t i = min(length, s * segment); i < end; i++) writer.put(cipherCode[data[i]], cipherLength[data[i]]);
+			writer.finish();
+		}
+	}
+
+	STATS_STOP(codingNs, codingStart);
+
+	return bits;
+}
+
+bool Huffman::countBlock(const unsigned char* data, size_t length, unsigned long long streamCounts[BLOCK_STREAMS][256], size_t& sampleLength)
+{
+	/* [Private Method]
+	* Fills charCounts[] with the counts a block's codes are built from, and returns true if every byte of
+	* the block is the same.
+	*
+	* Normally every byte is counted, and with setStreams(4) each substream's counts also go into
+	* streamCounts, to size the streams with. With setHistogramStride, a block big enough to give a sample
+	* of HISTOGRAM_SAMPLE_MIN bytes only has a sample counted (see sampleBytes). Its counts are scaled up to
+	* the block, and bytes the sample missed get a count of 1 so they still have a code. sampleLength is
+	* set to the number of bytes counted, which is length unless the block was sampled.
+	*/
+
+	int streamCount = streams;
+	size_t segment = (length + streamCount - 1) / streamCount;
+	bool sampled = histogramStride > 1 && length / histogramStride >= HISTOGRAM_SAMPLE_MIN;
+	bool oneValue;
+
+	STATS_START(countStart);
+	fill_n(charCounts, 256, 0);
+	sampleLength = length;
+
+	if (sampled)
+	{
+		sampleLength = sampleBytes(data, length, histogramStride, charCounts);
+
+		oneValue = charCounts[data[0]] == sampleLength && all_of(data, data + length, [data](unsigned char c) { return c == data[0]; }); // The sample only saw one byte, checked against the whole block
+
+		if (oneValue) charCounts[data[0]] = length;
+		else for (int i = 0; i < 256; i++) charCounts[i] = max(charCounts[i] * length / sampleLength, 1ULL); // Scaled up to the block, and every byte gets a code in case the sample missed it
+	}
+	else if (streamCount == 1) countBytes(data, length, charCounts);
+	else
+	{
+		for (int s = 0; s < streamCount; s++)
+		{
+			fill_n(streamCounts[s], 256, 0);
+			size_t start = min(length, s * segment);
+			countBytes(data + start, min(length, start + segment) - start, streamCounts[s]);
+			for (int i = 0; i < 256; i++) charCounts[i] += streamCounts[s][i];
+		}
+	}
+
+	if (!sampled) oneValue = charCounts[data[0]] == length;
+
+	symbolCount = length;
+	STATS_STOP(histogramNs, countStart);
+
+	return oneValue;
+}
+
+double Huffman::entropyBound(size_t length, size_t sampleLength, int& present)
+{
+	/* [Private Method]
+	* Returns the fewest bits any code for charCounts[] could take for a block of length bytes: the entropy
+	* of the counts, and at least 1 bit a byte however skewed they are. Sets present to the number of byte
+	* values with a count.
+	*
+	* If the counts came from a sample of sampleLength bytes, the sample's entropy runs low by about
+	* (present - 1) / (2 ln 2) bits per sampled byte (Miller-Madow), so that is added back. Otherwise random
+	* data would look just compressible enough to build a tree for.
+	*/
+
+	double entropyBits = 0;
+	present = 0;
+
+	for (int i = 0; i < 256; i++)
+	{
+		if (charCounts[i] == 0) continue;
+		entropyBits += charCounts[i] * log2((double)length / charCounts[i]);
+		present++;
+	}
+
+	if (sampleLength < length) entropyBits += (present - 1) * (double)length / (2.0 * sampleLength * log(2.0));
+
+	return max(entropyBits, (double)length);
+}
+
+void Huffman::estimateBlock(const unsigned char* data, size_t length, HuffmanEstimate& estimate, unsigned long long counts[256])
+{
+	/* [Private Method]
+	* Adds what encodeBlock would write for length bytes of data to estimate, and the block's counts to
+	* counts[]. The block goes through the same steps as in encodeBlock, up to where the size of its record
+	* is known, but no codes are assigned and no bits are written: a BLOCK_RLE record if it's one repeated
+	* byte, a BLOCK_STORED copy if the entropy or the code lengths say huffman codes can't shrink it, and
+	* otherwise its length table and the bits its counts take with those lengths.
+	*
+	* A sampled block is sized from its scaled counts, so its size is only an estimate. BLOCK_CONTEXT
+	* records aren't tried, since they need a count of every pair of bytes.
+	*/
+
+	int streamCount = streams;
+	unsigned long long streamCounts[BLOCK_STREAMS][256];
+	size_t sampleLength;
+
+	bool oneValue = countBlock(data, length, streamCounts, sampleLength);
+	bool sampled = sampleLength < length;
+
+	estimate.bytesIn += length;
+	estimate.blocks++;
+	estimate.sampled = estimate.sampled || sampled;
+	for (int i = 0; i < 256; i++) counts[i] += charCounts[i];
+
+	if (oneValue)
+	{
+		estimate.bytesOut += BLOCK_HEADER_SIZE + 1;
+		return;
+	}
+
+	int present;
+	double entropyBits = entropyBound(length, sampleLength, present);
+	size_t tableBytes = (present <= 32 ? 2 + present : 34) + (present + 1) / 2;
+
+	if (entropyBits / 8 + tableBytes < length)
+	{
+		initTree();
+		buildCipher();
+		limitCodeLengths(min(maxCodeLength, BLOCK_MAX_CODE_LENGTH));
+
+		unsigned char table[LENGTH_TABLE_SIZE];
+		int tableSize = writeLengthTable(table);
+		size_t streamsSize = 4 * (streamCount - 1); // Jump table, then each padded stream
+
+		if (streamCount == 1 || sampled) // A sample has no counts per stream, so its padding is left out
+		{
+			unsigned long long bits = 0;
+			for (int i = 0; i < 256; i++) bits += charCounts[i] * codeLengths[i];
+			streamsSize += (bits + 7) / 8;
+		}
+		else
+		{
+			for (int s = 0; s < streamCount; s++)
+			{
+				unsigned long long bits = 0;
+				for (int i = 0; i < 256; i++) bits += streamCounts[s][i] * codeLengths[i];
+				streamsSize += (bits + 7) / 8;
+			}
+		}
+
+		if (tableSize + streamsSize < length)
+		{
+			estimate.bytesOut += BLOCK_HEADER_SIZE + tableSize + streamsSize;
+			estimate.tableBytes += tableSize;
+			estimate.decodeTableBytes = max(estimate.decodeTableBytes, (unsigned long long)(sizeof(decodeTable) + (present - 1) * sizeof(decodeNodes[0]))); // A complete code over present bytes has present - 1 branches
+
+			for (int i = 0; i < 256; i++)
+			{
+				estimate.longestCode = max(estimate.longestCode, (int)codeLengths[i]);
+				if (codeLengths[i] > DECODE_BITS) estimate.slowBytes += charCounts[i];
+			}
+
+			return;
+		}
+	}
+
+	estimate.bytesOut += BLOCK_HEADER_SIZE + length; // Stored as it is
+	estimate.storedBlocks++;
+}
+
+void Huffman::finishEstimate(HuffmanEstimate& estimate, const vector<HuffmanEstimate>& parts, const vector<ByteCounts>& counts)
+{
+	/* [Private Method]
+	* Adds the estimates each worker made for its blocks into estimate, along with the parts of the file
+	* that aren't blocks: the 7-byte header, the empty record that ends the blocks, and the seek index.
+	* The entropy comes from the workers' counts, added together.
+	*/
+
+	estimate.upperBound = contextTables > 1;
+
+	unsigned long long total[256] = { 0 };
+
+	for (size_t w = 0; w < parts.size(); w++)
+	{
+		const HuffmanEstimate& part = parts[w];
+
+		estimate.bytesIn += part.bytesIn;
+		estimate.bytesOut += part.bytesOut;
+		estimate.sampled = estimate.sampled || part.sampled;
+		estimate.blocks += part.blocks;
+		estimate.storedBlocks += part.storedBlocks;
+		estimate.tableBytes += part.tableBytes;
+		estimate.longestCode = max(estimate.longestCode, part.longestCode);
+		estimate.decodeTableBytes = max(estimate.decodeTableBytes, part.decodeTableBytes);
+		estimate.slowBytes += part.slowBytes;
+
+		for (int i = 0; i < 256; i++) total[i] += counts[w].counts[i];
+	}
+
+	estimate.bytesOut += 7 + BLOCK_HEADER_SIZE + estimate.blocks * INDEX_ENTRY_SIZE + INDEX_FOOTER_SIZE;
+
+	unsigned long long counted = 0; // Sampled counts don't quite add up to bytesIn
+	for (int i = 0; i < 256; i++) counted += total[i];
+
+	estimate.entropy = 0;
+	for (int i = 0; i < 256; i++) if (total[i] > 0) estimate.entropy += (double)total[i] / counted * log2((double)counted / total[i]);
+}
+
+void Huffman::reportEstimate(const HuffmanEstimate& estimate, std::chrono::steady_clock::time_point start)
+{
+	/* [Private Method]
+	* Prints an estimate made by estimateFile, as a few lines of text, or as one line of JSON if
+	* setStatsJson was turned on. Prints nothing if quiet is set.
+	*/
+
+	if (quiet) return;
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double percent = 100.0 * estimate.bytesOut / max(estimate.bytesIn, 1ULL);
+
+	if (jsonStats)
+	{
+		cout << "{\"mode\":\"estimate\""
+			<< ",\"bytes_in\":" << estimate.bytesIn
+			<< ",\"bytes_out\":" << estimate.bytesOut
+			<< ",\"sampled\":" << (estimate.sampled ? "true" : "false")
+			<< ",\"upper_bound\":" << (estimate.upperBound ? "true" : "false")
+			<< ",\"seconds\":" << fixed << setprecision(6) << seconds
+			<< ",\"entropy\":" << setprecision(4) << estimate.entropy
+			<< ",\"blocks\":" << estimate.blocks
+			<< ",\"stored_blocks\":" << estimate.storedBlocks
+			<< ",\"table_bytes\":" << estimate.tableBytes
+			<< ",\"max_code_length\":" << estimate.longestCode
+			<< ",\"decode_table_bytes\":" << estimate.decodeTableBytes
+			<< ",\"slow_bytes\":" << estimate.slowBytes << "}" << endl;
+		return;
+	}
+
+	cout << "Encoded size: " << (estimate.upperBound ? "at most " : "") << estimate.bytesOut << " bytes, " << fixed << setprecision(3) << percent << "% of " << estimate.bytesIn
+		<< (estimate.sampled ? " (from sampled counts, not exact)" : "") << (estimate.upperBound ? " (-c isn't estimated, it can only make the file smaller)" : "") << endl;
+	cout << "Entropy: " << setprecision(3) << estimate.entropy << " bits per byte, " << (unsigned long long)(estimate.bytesIn * estimate.entropy / 8)
+		<< " bytes at best with one code table" << endl;
+	cout << "Blocks: " << estimate.blocks << ", " << estimate.storedBlocks << " stored as they are, " << estimate.tableBytes << " bytes of length tables" << endl;
+	cout << "Decode tables: " << estimate.decodeTableBytes << " bytes, longest code " << estimate.longestCode << " bits, "
+		<< 100.0 * estimate.slowBytes / max(estimate.bytesIn, 1ULL) << "% of bytes past the first lookup" << endl;
+	cout << setprecision(3) << seconds << " seconds to read " << estimate.bytesIn << " bytes, nothing written" << endl;
+}
+
+unsigned long long Huffman::writeSampledRecord(const unsigned char* data, size_t length, const unsigned char* table, int tableSize, vector<unsigned char>& out)
+{
+	/* [Private Method]
+	* Writes the record for a block whose codes were built from sampled counts, laid out exactly like the
+	* records encodeBlock writes, with table (tableSize bytes) as its length table.
+	*
+	* Without exact counts, the size of the bits is only known once they are written. A record that comes
+	* out as big as the block is stored instead anyway, so the record is written to recordScratch, which has
+	* room for that much plus what SAMPLE_CHECK_BYTES of data can add, and the bits are written
+	* SAMPLE_CHECK_BYTES at a time, checking in between that they still fit. If they don't, the record is
+	* dropped for a BLOCK_STORED one. The jump table is filled in as each stream is finished, and only the
+	* bytes of the finished record are copied to out. recordScratch is kept from block to block, so it is
+	* only zero-filled when it first grows.
+	*
+	* Returns the length of the encoded bits, not counting the padding.
+	*/
+
+	int streamCount = streams;
+	size_t segment = (length + streamCount - 1) / streamCount;
+	size_t limit = length - 1; // Largest payload worth writing
+
+	size_t room = BLOCK_HEADER_SIZE + limit + SAMPLE_CHECK_BYTES * BLOCK_MAX_CODE_LENGTH / 8 + 8;
+	if (recordScratch.size() < room) recordScratch.resize(room);
+	unsigned char* record = recordScratch.data();
+	unsigned char* payload = record + BLOCK_HEADER_SIZE;
+	copy(table, table + tableSize, payload);
+
+	STATS_START(codingStart);
+
+	BitWriter writer;
+	writer.out = payload + tableSize;
+	unsigned char* jump = writer.out;
+	writer.out += 4 * (streamCount - 1);
+
+	unsigned long long bits = 0;
+
+	for (int s = 0; s < streamCount; s++)
+	{
+		unsigned char* streamStart = writer.out;
+		size_t end = min(length, (s + 1) * segment);
+
+		for (size_t i = min(length, s * segment); i < end; )
+		{
+			size_t checkpoint = min(end, i + SAMPLE_CHECK_BYTES);
+			for (; i < checkpoint; i++) writer.put(cipherCode[data[i]], cipherLength[data[i]]);
+
+			if ((size_t)(writer.out - payload) > limit) // The sample's codes don't suit the rest of the block
+			{
+				STATS_STOP(codingNs, codingStart);
+				return storeBlock(data, length, BLOCK_STORED, out);
+			}
+		}
+
+		bits += 8 * (writer.out - streamStart) + writer.count;
+		writer.finish();
+
+		size_t streamLength = writer.out - streamStart;
+		for (int i = 0; i < 4 && s < streamCount - 1; i++) jump[4 * s + i] = (unsigned char)(streamLength >> (8 * i));
+	}
+
+	STATS_STOP(codingNs, codingStart);
+
+	size_t payloadLength = writer.out - payload;
+
+	if (payloadLength > limit) return storeBlock(data, length, BLOCK_STORED, out); // Only the padding was left to push it over
+
+	for (int i = 0; i < 4; i++) record[i] = (unsigned char)(length >> (8 * i));
+	record[4] = streamCount == 1 ? BLOCK_HUFFMAN : BLOCK_HUFFMAN4;
+	for (int i = 0; i < 4; i++) record[5 + i] = (unsigned char)(payloadLength >> (8 * i));
+
+	out.insert(out.end(), record, record + BLOCK_HEADER_SIZE + payloadLength);
+
+	return bits;
+}
+
+unsigned long long Huffman::storeBlock(const unsigned char* data, size_t length, int type, vector<unsigned char>& out)
+{
+	/* [Private Method]
+	* Appends data to out as a record that isn't huffman coded: a BLOCK_STORED record's payload is the
+	* length bytes of data as they are, and a BLOCK_RLE record's is the one byte that fills the whole block.
+	* Returns the length of the payload in bits.
+	*/
+
+	size_t payloadLength = type == BLOCK_RLE ? 1 : length;
+
+	size_t start = out.size();
+	out.resize(start + BLOCK_HEADER_SIZE + payloadLength);
+	unsigned char* record = out.data() + start;
+
+	for (int i = 0; i < 4; i++) record[i] = (unsigned char)(length >> (8 * i));
+	record[4] = type;
+	for (int i = 0; i < 4; i++) record[5 + i] = (unsigned char)(payloadLength >> (8 * i));
+
+	STATS_START(codingStart);
+	copy(data, data + payloadLength, record + BLOCK_HEADER_SIZE);
+	STATS_STOP(codingNs, codingStart);
+
+	return (unsigned long long)payloadLength * 8;
+}
+
+bool Huffman::encodeContextBlock(const unsigned char* data, size_t length, vector<unsigned char>& out, double order0Bits, unsigned long long& bits)
+{
+	/* [Private Method]
+	* Tries to encode data as a BLOCK_CONTEXT record, where each byte is coded with a table picked by the byte
+	* before it (0 for the first byte). Text like logs follows its previous byte closely, so this can be much
+	* smaller than one table for the whole block. The record's payload is:
+	*
+	*	number of tables (1 byte, at most CONTEXT_MAX_TABLES)
+	*	the table after each previous byte, a nibble each (128 bytes, high nibble first)
+	*	each table's length table (see writeLengthTable)
+	*	the encoded bits, padded to a whole byte
+	*
+	* 256 tables would cost too much header and cache, so clusterContexts groups the previous bytes into at
+	* most contextTables tables. If the entropy of the clusters plus the header isn't smaller than order0Bits
+	* (the same estimate for a BLOCK_HUFFMAN record), nothing is written and false is returned. Otherwise
+	* returns true with bits set to the length of the encoded bits, storing the block instead if the real
+	* codes come out no smaller than it.
+	*/
+
+	if (order0Bits <= 8.0 * (1 + 128 + 4)) return false; // The map and one table would already cost more, don't bother counting
+
+	STATS_START(countStart);
+
+	contextCounts.assign(256 * 256, 0);
+	int previous = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		contextCounts[previous * 256 + data[i]]++;
+		previous = data[i];
+	}
+
+	STATS_STOP(histogramNs, countStart);
+	STATS_START(clusterStart);
+
+	int tables = clusterContexts();
+
+	double estimateBits = 8.0 * (1 + 128); // Table count and map
+	for (int t = 0; t < tables; t++)
+	{
+		const unsigned long long* counts = &clusterCounts[t * 256];
+		unsigned long long total = 0;
+		int present = 0;
+		for (int i = 0; i < 256; i++)
+		{
+			total += counts[i];
+			if (counts[i] > 0) present++;
+		}
+		double clusterBits = 0;
+		for (int i = 0; i < 256; i++) if (counts[i] > 0) clusterBits += counts[i] * log2((double)total / counts[i]);
+		estimateBits += max(clusterBits, (double)total); // Every code is at least 1 bit
+		estimateBits += 8.0 * ((present <= 32 ? 2 + present : 34) + (present + 1) / 2);
+	}
+
+	STATS_STOP(tableNs, clusterStart);
+
+	if (estimateBits >= order0Bits) return false;
+
+	contextCodes.resize(tables * 256);
+	contextLengths.resize(tables * 256);
+
+	vector<unsigned char> header(1 + 128 + tables * LENGTH_TABLE_SIZE);
+	size_t headerSize = 1 + 128;
+	header[0] = tables;
+	for (int i = 0; i < 256; i += 2) header[1 + i / 2] = (contextMap[i] << 4) | contextMap[i + 1];
+
+	bits = 0;
+
+	for (int t = 0; t < tables; t++) // Builds each table's codes with the same steps as an order-0 block
+	{
+		STATS_START(treeStart);
+		copy(&clusterCounts[t * 256], &clusterCounts[t * 256] + 256, charCounts);
+		initTree();
+		STATS_STOP(treeNs, treeStart);
+
+		STATS_START(tableStart);
+		buildCipher();
+		limitCodeLengths(min(maxCodeLength, BLOCK_MAX_CODE_LENGTH));
+		assignCanonicalCodes();
+		STATS_STOP(tableNs, tableStart);
+
+		headerSize += writeLengthTable(header.data() + headerSize);
+		for (int i = 0; i < 256; i++)
+		{
+			contextCodes[t * 256 + i] = cipherCode[i];
+			contextLengths[t * 256 + i] = cipherLength[i];
+			bits += charCounts[i] * codeLengths[i];
+			STATS_MAX(maxCodeLength, codeLengths[i]);
+		}
+	}
+
+	size_t payloadLength = headerSize + (bits + 7) / 8;
+
+	if (payloadLength >= length)
+	{
+		bits = storeBlock(data, length, BLOCK_STORED, out);
+		return true;
+	}
+
+	size_t start = out.size();
+	out.resize(start + BLOCK_HEADER_SIZE + payloadLength);
+	unsigned char* record = out.data() + start;
+
+	for (int i = 0; i < 4; i++) record[i] = (unsigned char)(length >> (8 * i));
+	record[4] = BLOCK_CONTEXT;
+	for (int i = 0; i < 4; i++) record[5 + i] = (unsigned char)(payloadLength >> (8 * i));
+	copy(header.data(), header.data() + headerSize, record + BLOCK_HEADER_SIZE);
+
+	STATS_START(codingStart);
+
+	BitWriter writer;
+	writer.out = record + BLOCK_HEADER_SIZE + headerSize;
+
+	const unsigned int* codes = contextCodes.data();
+	const unsigned char* lengths = contextLengths.data();
+	previous = 0;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		int table = contextMap[previous] * 256;
+		writer.put(codes[table + data[i]], lengths[table + data[i]]);
+		previous = data[i];
+	}
+
+	writer.finish();
+
+	STATS_STOP(codingNs, codingStart);
+
+	return true;
+}
+
+int Huffman::clusterContexts()
+{
+	/* [Private Method]
+	* IMPORTANT: MAKE SURE contextCounts HAS BEEN FILLED BEFORE CALLING
+	*
+	* Groups the 256 previous-byte contexts into at most contextTables tables, filling contextMap[] and
+	* clusterCounts, and returns the number of tables.
+	*
+	* If few enough contexts were used, each gets its own table. Otherwise it's k-means, where a context's
+	* distance to a table is the number of bits its bytes would take with that table's code (estimated as
+	* -log2 of each byte's share of the table). The busiest contexts start off the tables, then every context
+	* joins the table that codes it best and the tables are recounted, up to four times or until no context
+	* moves. Contexts that were never used go to table 0.
+	*/
+
+	unsigned long long totals[256] = { 0 };
+	vector<int> active; // Contexts that were used, busiest first
+
+	for (int c = 0; c < 256; c++)
+	{
+		for (int i = 0; i < 256; i++) totals[c] += contextCounts[c * 256 + i];
+		if (totals[c] > 0) active.push_back(c);
+	}
+
+	stable_sort(active.begin(), active.end(), [&totals](int a, int b) { return totals[a] > totals[b]; });
+
+	fill_n(contextMap, 256, 0);
+	int tables = min((int)active.size(), contextTables);
+
+	for (int t = 0; t < tables; t++) contextMap[active[t]] = t; // Seeds, and the whole answer when every context gets its own table
+
+	vector<vector<pair<int, unsigned int>>> used(256); // Bytes each active context saw, with their counts
+	for (int c : active)
+	{
+		for (int i = 0; i < 256; i++) if (contextCounts[c * 256 + i] > 0) used[c].push_back({ i, contextCounts[c * 256 + i] });
+	}
+
+	vector<double> cost(tables * 256); // Bits to code each byte with each table
+
+	bool changed = true;
+
+	for (int pass = 0; pass < 4 && changed && (int)active.size() > tables; pass++)
+	{
+		changed = false;
+
+		clusterCounts.assign(tables * 256, 0);
+
+		for (size_t k = 0; k < active.size(); k++)
+		{
+			int c = active[k];
+			if (pass == 0 && k >= (size_t)tables) continue; // Only the seeds are counted on the first pass
+			for (const pair<int, unsigned int>& byte : used[c]) clusterCounts[contextMap[c] * 256 + byte.first] += byte.second;
+		}
+
+		for (int t = 0; t < tables; t++)
+		{
+			unsigned long long total = 0;
+			for (int i = 0; i < 256; i++) total += clusterCounts[t * 256 + i];
+			for (int i = 0; i < 256; i++) cost[t * 256 + i] = -log2((clusterCounts[t * 256 + i] + 0.5) / (total + 128.0)); // Unseen bytes still get a cost
+		}
+
+		for (int c : active)
+		{
+			double best = -1;
+			int bestTable = 0;
+			for (int t = 0; t < tables; t++)
+			{
+				double bitsUsed = 0;
+				for (const pair<int, unsigned int>& byte : used[c]) bitsUsed += byte.second * cost[t * 256 + byte.first];
+				if (best < 0 || bitsUsed < best)
+				{
+					best = bitsUsed;
+					bestTable = t;
+				}
+			}
+
+			if (pass == 0 || contextMap[c] != bestTable) changed = true; // Stops early once no context moves
+			contextMap[c] = bestTable;
+		}
+	}
+
+	int renumber[CONTEXT_MAX_TABLES]; // Drops tables no context chose
+	fill_n(renumber, CONTEXT_MAX_TABLES, -1);
+	int kept = 0;
+	for (int c : active) if (renumber[contextMap[c]] < 0) renumber[contextMap[c]] = kept++;
+	for (int c : active) contextMap[c] = renumber[contextMap[c]];
+	if (kept == 0) kept = 1;
+
+	clusterCounts.assign(kept * 256, 0);
+	for (int c : active)
+	{
+		for (const pair<int, unsigned int>& byte : used[c]) clusterCounts[contextMap[c] * 256 + byte.first] += byte.second;
+	}
+
+	return kept;
+}
+
+bool Huffman::decodeBlock(const unsigned char* payload, size_t payloadLength, int type, unsigned char* out, size_t rawLength)
+{
+	/* [Private Method]
+	* Decodes the payload of a block record written by encodeBlock into the rawLength bytes at out, either
+	* as one stream or, for BLOCK_HUFFMAN4, as interleaved substreams. Stored and RLE blocks are just copied
+	* or filled in. Returns false if the payload is corrupt.
+	*/
+
+	if (type == BLOCK_STORED || type == BLOCK_RLE)
+	{
+		if (payloadLength != (type == BLOCK_RLE ? 1 : rawLength)) return false;
+
+		STATS_START(codingStart);
+		if (type == BLOCK_RLE) fill_n(out, rawLength, payload[0]);
+		else copy(payload, payload + rawLength, out);
+		STATS_STOP(codingNs, codingStart);
+
+		STATS_ADD(blocks, 1);
+		return true;
+	}
+
+	if (type == BLOCK_CONTEXT) return decodeContextBlock(payload, payloadLength, out, rawLength);
+
+	if (type != BLOCK_HUFFMAN && type != BLOCK_HUFFMAN4) return false;
+
+	STATS_START(tableStart);
+
+	int tableSize = readLengthTable(payload, payloadLength);
+	if (tableSize < 0) return false;
+
+	for (int i = 0; i < 256; i++)
+	{
+		if (codeLengths[i] > BLOCK_MAX_CODE_LENGTH) return false;
+		STATS_MAX(maxCodeLength, codeLengths[i]);
+	}
+
+	compileDecoderFromLengths();
+
+	STATS_STOP(tableNs, tableStart);
+	STATS_START(codingStart);
+
+	bool decoded;
+
+	if (type == BLOCK_HUFFMAN4) decoded = decodeStreams(payload + tableSize, payloadLength - tableSize, out, rawLength);
+	else
+	{
+		BitReader reader;
+		reader.in = payload + tableSize;
+		reader.end = payload + payloadLength;
+		decoded = decodeBits(reader, out, rawLength);
+	}
+
+	STATS_STOP(codingNs, codingStart);
+	STATS_ADD(blocks, 1);
+
+	return decoded;
+}
+
+bool Huffman::decodeContextBlock(const unsigned char* payload, size_t payloadLength, unsigned char* out, size_t rawLength)
+{
+	/* [Private Method]
+	* Decodes a BLOCK_CONTEXT payload (see encodeContextBlock) into the rawLength bytes at out. Each table is
+	* compiled like an order-0 block's, then copied into contextDecodeTables and contextDecodeNodes so all of
+	* them are ready at once. Returns false if the payload is corrupt.
+	*/
+
+	STATS_START(tableStart);
+
+	if (payloadLength < 1 + 128) return false;
+
+	int tables = payload[0];
+	if (tables < 1 || tables > CONTEXT_MAX_TABLES) return false;
+
+	for (int i = 0; i < 256; i += 2)
+	{
+		contextMap[i] = payload[1 + i / 2] >> 4;
+		contextMap[i + 1] = payload[1 + i / 2] & 0x0F;
+		if (contextMap[i] >= tables || contextMap[i + 1] >= tables) return false;
+	}
+
+	contextDecodeTables.resize(tables << DECODE_BITS);
+	contextDecodeNodes.resize(tables * 511 * 2);
+	size_t offset = 1 + 128;
+
+	for (int t = 0; t < tables; t++)
+	{
+		int tableSize = readLengthTable(payload + offset, payloadLength - offset);
+		if (tableSize < 0) return false;
+		offset += tableSize;
+
+		for (int i = 0; i < 256; i++)
+		{
+			if (codeLengths[i] > BLOCK_MAX_CODE_LENGTH) return false;
+			STATS_MAX(maxCodeLength, codeLengths[i]);
+		}
+
+		compileDecoderFromLengths();
+		copy(decodeTable, decodeTable + (1 << DECODE_BITS), contextDecodeTables.begin() + (t << DECODE_BITS));
+		copy(&decodeNodes[0][0], &decodeNodes[0][0] + 511 * 2, contextDecodeNodes.begin() + t * 511 * 2);
+	}
+
+	STATS_STOP(tableNs, tableStart);
+	STATS_START(codingStart);
+
+	BitReader reader;
+	reader.in = payload + offset;
+	reader.end = payload + payloadLength;
+	bool decoded = decodeContextBits(reader, out, rawLength);
+
+	STATS_STOP(codingNs, codingStart);
+	STATS_ADD(blocks, 1);
+
+	return decoded;
+}
+
+inline int Huffman::decodeSymbol(BitReader& reader, const DecodeEntry* table, const short (*tableNodes)[2])
+{
+	/* [Private Method]
+	* Decodes the next code in reader with table and tableNodes (decodeTable[] and decodeNodes[], or one of the
+	* context tables). The code must already be entirely in reader's buffer (or be followed only by padding).
+	* Returns the byte, or -1 if the buffer ran out partway through the code.
+	*/
+
+	const DecodeEntry& entry = table[reader.buffer >> (64 - DECODE_BITS)];
+
+	if (entry.length != 0) // The whole code fit in the table
+	{
+		reader.buffer <<= entry.length;
+		reader.count -= entry.length;
+		return entry.symbol;
+	}
+
+	reader.buffer <<= DECODE_BITS; // Code is longer than DECODE_BITS, walk the rest of it bit-by-bit
+	reader.count -= DECODE_BITS;
+
+	int node = entry.symbol;
+	while (node >= 0)
+	{
+		if (reader.count == 0) return -1;
+		node = tableNodes[node][reader.buffer >> 63];
+		reader.buffer <<= 1;
+		reader.count--;
+	}
+
+	return (unsigned char)~node;
+}
+
+bool Huffman::decodeBits(BitReader& reader, unsigned char* out, size_t outLength)
+{
+	/* [Private Method]
+	* IMPORTANT: MAKE SURE decodeTable[] AND decodeNodes[] HAVE BEEN COMPILED BEFORE CALLING
+	*
+	* Decodes exactly outLength bytes from the bits left in reader. Returns false if the bits run out first.
+	*
+	* Works like decodeBitstream, but on memory. Codes are at most BLOCK_MAX_CODE_LENGTH bits, so once the bit
+	* buffer has been refilled, even a code longer than DECODE_BITS can be walked without running out of bits.
+	*/
+
+	size_t outIndex = 0;
+
+	while (outIndex < outLength)
+	{
+		reader.refill();
+
+		bool endOfInput = reader.in == reader.end; // Every bit left is in the buffer, and the bits after them are 0s
+
+		while (reader.count >= DECODE_BITS && outIndex < outLength)
+		{
+			if (decodeTable[reader.buffer >> (64 - DECODE_BITS)].length == 0 && reader.count < BLOCK_MAX_CODE_LENGTH && !endOfInput) break; // Refill first, so the whole code is in the buffer
+
+			int symbol = decodeSymbol(reader, decodeTable, decodeNodes);
+			if (symbol < 0) return false;
+			out[outIndex++] = (unsigned char)symbol;
+		}
+
+		if (endOfInput && reader.count < DECODE_BITS && outIndex < outLength) // Last few bits, the 0s below them pad out the table lookup
+		{
+			const DecodeEntry& entry = decodeTable[reader.buffer >> (64 - DECODE_BITS)];
+			if (entry.length == 0 || entry.length > reader.count) return false;
+
+			out[outIndex++] = (unsigned char)entry.symbol;
+			reader.buffer <<= entry.length;
+			reader.count -= entry.length;
+		}
+	}
+
+	return true;
+}
+
+bool Huffman::decodeContextBits(BitReader& reader, unsigned char* out, size_t outLength)
+{
+	/* [Private Method]
+	* IMPORTANT: MAKE SURE contextMap[], contextDecodeTables AND contextDecodeNodes HAVE BEEN FILLED BEFORE CALLING
+	*
+	* Works like decodeBits, except each code is looked up in the table contextMap[] picks for the byte
+	* decoded just before it (0 for the first). Picking the table is one small lookup per byte, so this
+	* stays close to the speed of decodeBits.
+	*/
+
+	const DecodeEntry* tables = contextDecodeTables.data();
+	const short (*tableNodes)[2] = (const short (*)[2])contextDecodeNodes.data();
+	size_t outIndex = 0;
+	int previous = 0;
+
+	while (outIndex < outLength)
+	{
+		reader.refill();
+
+		bool endOfInput = reader.in == reader.end; // Every bit left is in the buffer, and the bits after them are 0s
+
+		while (reader.count >= DECODE_BITS && outIndex < outLength)
+		{
+			int table = contextMap[previous];
+			const DecodeEntry* entries = tables + (table << DECODE_BITS);
+
+			if (entries[reader.buffer >> (64 - DECODE_BITS)].length == 0 && reader.count < BLOCK_MAX_CODE_LENGTH && !endOfInput) break; // Refill first, so the whole code is in the buffer
+
+			previous = decodeSymbol(reader, entries, tableNodes + table * 511);
+			if (previous < 0) return false;
+			out[outIndex++] = (unsigned char)previous;
+		}
+
+		if (endOfInput && reader.count < DECODE_BITS && outIndex < outLength) // Last few bits, the 0s below them pad out the table lookup
+		{
+			const DecodeEntry& entry = tables[(contextMap[previous] << DECODE_BITS) + (reader.buffer >> (64 - DECODE_BITS))];
+			if (entry.length == 0 || entry.length > reader.count) return false;
+
+			previous = entry.symbol;
+			out[outIndex++] = (unsigned char)previous;
+			reader.buffer <<= entry.length;
+			reader.count -= entry.length;
+		}
+	}
+
+	return true;
+}
+
+bool Huffman::decodeStreams(const unsigned char* in, size_t inLength, unsigned char* out, size_t outLength)
+{
+	/* [Private Method]
+	* IMPORTANT: MAKE SURE decodeTable[] AND decodeNodes[] HAVE BEEN COMPILED BEFORE CALLING
+	*
+	* Decodes the BLOCK_STREAMS substreams of a BLOCK_HUFFMAN4 payload (after its length table) into the
+	* outLength bytes at out. Returns false if the jump table or any of the streams is corrupt.
+	*
+	* A single stream is one long dependency chain, since each code's length decides where the next one
+	* starts. The substreams don't depend on each other, so here they are decoded in lockstep: each pass
+	* refills all four bit buffers, then takes a symbol from each in turn, which lets the CPU work on four
+	* table lookups at once. With every buffer holding at least 56 bits, 56 / longest codes can be taken
+	* from each stream before the next refill without any checks. Once a stream gets near the end of its
+	* input or output, the rest of each one is finished by decodeBits.
+	*/
+
+	size_t jumpSize = 4 * (BLOCK_STREAMS - 1);
+	if (inLength < jumpSize) return false;
+
+	BitReader readers[BLOCK_STREAMS];
+	unsigned char* outs[BLOCK_STREAMS];
+	unsigned char* outEnds[BLOCK_STREAMS];
+	size_t segment = (outLength + BLOCK_STREAMS - 1) / BLOCK_STREAMS; // Symbols in each stream, the last one gets what's left
+	size_t offset = jumpSize;
+
+	for (int s = 0; s < BLOCK_STREAMS; s++)
+	{
+		size_t streamLength = inLength - offset; // The last stream runs to the end of the payload
+
+		if (s < BLOCK_STREAMS - 1)
+		{
+			streamLength = 0;
+			for (int i = 0; i < 4; i++) streamLength |= (size_t)in[4 * s + i] << (8 * i);
+			if (streamLength > inLength - offset) return false;
+		}
+
+		readers[s].in = in + offset;
+		readers[s].end = in + offset + streamLength;
+		outs[s] = out + min(outLength, s * segment);
+		outEnds[s] = out + min(outLength, (s + 1) * segment);
+		offset += streamLength;
+	}
+
+	int longest = 1;
+	for (int i = 0; i < 256; i++) longest = max(longest, (int)codeLengths[i]);
+	int perRefill = 56 / longest; // Codes that always fit in a freshly refilled buffer
+
+	while (true)
+	{
+		bool ready = true; // Every stream has 8 bytes to refill from and room for a whole pass
+		for (int s = 0; s < BLOCK_STREAMS; s++) ready &= readers[s].end - readers[s].in >= 8 && outEnds[s] - outs[s] >= perRefill;
+		if (!ready) break;
+
+		for (int s = 0; s < BLOCK_STREAMS; s++) readers[s].refillFast();
+
+		for (int k = 0; k < perRefill; k++)
+		{
+			for (int s = 0; s < BLOCK_STREAMS; s++) *(outs[s]++) = (unsigned char)decodeSymbol(readers[s], decodeTable, decodeNodes); // Can't fail, the whole code is in the buffer
+		}
+	}
+
+	for (int s = 0; s < BLOCK_STREAMS; s++)
+	{
+		if (!decodeBits(readers[s], outs[s], outEnds[s] - outs[s])) return false;
+	}
+
+	return true;
+}
+
+bool Huffman::decodeBlocks(string inputFile, istream& input, ostream& output)
+{
+	/* [Private Method]
+	* Reads the block records that follow a BLOCK_FORMAT header one at a time, decodes each one with
+	* decodeBlock, and writes it to output. Stops at the empty record marking the end of the file.
+	*
+	* If inputFile can be memory mapped, the records are decoded straight from the mapping, starting where
+	* input is. Otherwise (or when there is no inputFile, like when input is cin) each one is read from input
+	* into a buffer first.
+	*
+	* Like encodeBlocks, the records go through a Pipeline, so the next record is read and the last block is
+	* written while this one is decoded.
+	*
+	* Returns false if a record is damaged or the file ends before its last record. Nothing is printed, since
+	* output may be cout, so the caller says so.
+	*/
+
+	MappedFile mapped;
+	bool isMapped = useMapping && inputFile != "" && mapped.openRead(inputFile);
+	size_t offset = isMapped ? (size_t)input.tellg() : 0; // Position of the next record in the mapping
+
+	struct RecordSlot
+	{
+		unsigned char header[BLOCK_HEADER_SIZE] = { 0 };
+		vector<unsigned char> payloadBuffer; // Holds the payload when the input isn't mapped
+		const unsigned char* payload = nullptr; // The payload, either in payloadBuffer or in the mapping
+		size_t rawLength = 0;
+		size_t payloadLength = 0;
+		bool complete = false; // Whether the whole record was there to read
+		vector<unsigned char> out; // The decoded block
+	};
+
+	Pipeline pipeline(PIPELINE_SLOTS, pipelined);
+	vector<RecordSlot> slots(pipeline.size());
+
+	HuffmanStats readStats, writeStats; // The reader and writer count their bytes and time here, apart from this thread's stats
+	bool truncated = false;
+
+	bool decoded = pipeline.run([&](size_t i) // Reads the next record, returns false at the end record (or once one was cut short)
+	{
+		[[maybe_unused]] HuffmanStats& stats = readStats;
+		RecordSlot& slot = slots[i];
+
+		if (truncated) return false;
+
+		size_t headerRead;
+
+		if (isMapped)
+		{
+			headerRead = min((size_t)BLOCK_HEADER_SIZE, mapped.size() - offset);
+			copy(mapped.data() + offset, mapped.data() + offset + headerRead, slot.header);
+			offset += headerRead;
+		}
+		else
+		{
+			STATS_START(readStart);
+			input.read((char*)slot.header, BLOCK_HEADER_SIZE);
+			STATS_STOP(ioNs, readStart);
+			headerRead = input.gcount();
+		}
+
+		stats.bytesIn += headerRead;
+
+		readRecordHeader(slot.header, slot.rawLength, slot.payloadLength);
+
+		if (headerRead == BLOCK_HEADER_SIZE && slot.rawLength == 0) return false; // End of file
+
+		size_t payloadRead = 0;
+
+		if (isMapped)
+		{
+			payloadRead = min(slot.payloadLength, mapped.size() - offset);
+			slot.payload = mapped.data() + offset;
+			offset += payloadRead;
+		}
+		else
+		{
+			slot.payloadBuffer.resize(slot.payloadLength);
+
+			STATS_START(readStart);
+			input.read((char*)slot.payloadBuffer.data(), slot.payloadLength);
+			STATS_STOP(ioNs, readStart);
+
+			payloadRead = input.gcount();
+			slot.payload = slot.payloadBuffer.data();
+		}
+
+		stats.bytesIn += payloadRead;
+
+		slot.complete = headerRead == BLOCK_HEADER_SIZE && payloadRead == slot.payloadLength;
+		truncated = !slot.complete;
+
+		return true;
+	},
+	[&](size_t i) // Decodes it, returns false if it's corrupt
+	{
+		RecordSlot& slot = slots[i];
+
+		if (!slot.complete || slot.rawLength > fileBlockSize) return false;
+
+		slot.out.resize(fileBlockSize);
+		return decodeBlock(slot.payload, slot.payloadLength, slot.header[4], slot.out.data(), slot.rawLength);
+	},
+	[&](size_t i) // Writes it out
+	{
+		[[maybe_unused]] HuffmanStats& stats = writeStats;
+		RecordSlot& slot = slots[i];
+
+		STATS_START(writeStart);
+		output.write((char*)slot.out.data(), slot.rawLength);
+		STATS_STOP(ioNs, writeStart);
+
+		stats.bytesOut += slot.rawLength;
+	});
+
+	stats.bytesIn += readStats.bytesIn;
+	stats.bytesOut += writeStats.bytesOut;
+	stats.ioNs += readStats.ioNs + writeStats.ioNs;
+
+	return decoded;
+}
+
+void Huffman::readRecordHeader(const unsigned char header[BLOCK_HEADER_SIZE], size_t& rawLength, size_t& payloadLength)
+{
+	/* [Private Method]
+	* Pulls the raw and payload lengths out of a block record's header. The block type is header[4].
+	*/
+
+	rawLength = 0;
+	payloadLength = 0;
+
+	for (int i = 0; i < 4; i++)
+	{
+		rawLength |= (size_t)header[i] << (8 * i);
+		payloadLength |= (size_t)header[5 + i] << (8 * i);
+	}
+}
+
+void Huffman::writeIndex(vector<unsigned char>& output, const vector<BlockIndexEntry>& index, unsigned long long rawSize)
+{
+	/* [Private Method]
+	* Appends the seek index that goes after the end marker of a BLOCK_FORMAT file to output:
+	*
+	*	for each block: offset of its record in the file, offset of its bytes in the decoded file, and the
+	*					length of its bitstream in bits (8 bytes each, little endian)
+	*	size of the decoded file (8 bytes, little endian)
+	*	number of blocks (4 bytes, little endian)
+	*	"HFIX"
+	*
+	* The footer is a fixed size at the very end, so a decoder can find the index by seeking back from the end.
+	* Decoders reading the blocks in order stop at the end marker and never see it.
+	*/
+
+	size_t start = output.size();
+	output.resize(start + index.size() * INDEX_ENTRY_SIZE + INDEX_FOOTER_SIZE);
+	unsigned char* out = output.data() + start;
+
+	for (size_t i = 0; i < index.size(); i++)
+	{
+		for (int j = 0; j < 8; j++)
+		{
+			out[j] = (unsigned char)(index[i].compressedOffset >> (8 * j));
+			out[8 + j] = (unsigned char)(index[i].rawOffset >> (8 * j));
+			out[16 + j] = (unsigned char)(index[i].bits >> (8 * j));
+		}
+		out += INDEX_ENTRY_SIZE;
+	}
+
+	for (int j = 0; j < 8; j++) out[j] = (unsigned char)(rawSize >> (8 * j));
+	for (int j = 0; j < 4; j++) out[8 + j] = (unsigned char)(index.size() >> (8 * j));
+	out[12] = 'H';
+	out[13] = 'F';
+	out[14] = 'I';
+	out[15] = 'X';
+}
+
+bool Huffman::readIndex(ifstream& input, vector<BlockIndexEntry>& index, unsigned long long& rawSize)
+{
+	/* [Private Method]
+	* Reads the seek index written by writeIndex into index and rawSize. Returns false if input doesn't end
+	* with one, or if it doesn't make sense for a file of this size (every record must start past the header,
+	* before the index, and after the one before it, and every block's decoded bytes must follow the last one's).
+	*
+	* input is put back where it was either way.
+	*/
+
+	streampos start = input.tellg();
+	input.seekg(0, ios::end);
+	unsigned long long fileSize = input.tellg();
+
+	bool found = false;
+	unsigned char footer[INDEX_FOOTER_SIZE];
+
+	if (fileSize >= 7 + BLOCK_HEADER_SIZE + INDEX_FOOTER_SIZE)
+	{
+		input.seekg(fileSize - INDEX_FOOTER_SIZE);
+		input.read((char*)footer, INDEX_FOOTER_SIZE);
+		found = input.gcount() == INDEX_FOOTER_SIZE && footer[12] == 'H' && footer[13] == 'F' && footer[14] == 'I' && footer[15] == 'X';
+	}
+
+	unsigned long long count = 0;
+	rawSize = 0;
+
+	if (found)
+	{
+		for (int j = 0; j < 8; j++) rawSize |= (unsigned long long)footer[j] << (8 * j);
+		for (int j = 0; j < 4; j++) count |= (unsigned long long)footer[8 + j] << (8 * j);
+
+		found = count * INDEX_ENTRY_SIZE + INDEX_FOOTER_SIZE + BLOCK_HEADER_SIZE + 7 <= fileSize;
+	}
+
+	unsigned long long indexStart = fileSize - INDEX_FOOTER_SIZE - count * INDEX_ENTRY_SIZE;
+	vector<unsigned char> buffer;
+
+	if (found)
+	{
+		buffer.resize(count * INDEX_ENTRY_SIZE);
+		input.seekg(indexStart);
+		input.read((char*)buffer.data(), buffer.size());
+		found = input.gcount() == (streamsize)buffer.size();
+	}
+
+	index.clear();
+	if (found) found = parseIndex(buffer.data(), count, indexStart, rawSize, index);
+
+	input.clear();
+	input.seekg(start);
+
+	return found;
+}
+
+bool Huffman::readIndex(span<const unsigned char> input, vector<BlockIndexEntry>& index, unsigned long long& rawSize)
+{
+	/* [Private Method]
+	* Reads the seek index at the end of a block file held in memory, like readIndex does for a file.
+	*/
+
+	index.clear();
+	rawSize = 0;
+
+	if (input.size() < 7 + BLOCK_HEADER_SIZE + INDEX_FOOTER_SIZE) return false;
+
+	const unsigned char* footer = input.data() + input.size() - INDEX_FOOTER_SIZE;
+	if (footer[12] != 'H' || footer[13] != 'F' || footer[14] != 'I' || footer[15] != 'X') return false;
+
+	unsigned long long count = 0;
+	for (int j = 0; j < 8; j++) rawSize |= (unsigned long long)footer[j] << (8 * j);
+	for (int j = 0; j < 4; j++) count |= (unsigned long long)footer[8 + j] << (8 * j);
+
+	if (count * INDEX_ENTRY_SIZE + INDEX_FOOTER_SIZE + BLOCK_HEADER_SIZE + 7 > input.size()) return false;
+
+	unsigned long long indexStart = input.size() - INDEX_FOOTER_SIZE - count * INDEX_ENTRY_SIZE;
+
+	return parseIndex(input.data() + indexStart, count, indexStart, rawSize, index);
+}
+
+bool Huffman::parseIndex(const unsigned char* entries, unsigned long long count, unsigned long long indexStart, unsigned long long rawSize, vector<BlockIndexEntry>& index)
+{
+	/* [Private Method]
+	* Reads count index entries from entries into index, checking each one as it goes. Returns false if
+	* they don't make sense for a file whose index starts at indexStart and that decodes to rawSize bytes.
+	*/
+
+	index.clear();
+
+	for (unsigned long long i = 0; i < count; i++)
+	{
+		const unsigned char* in = entries + i * INDEX_ENTRY_SIZE;
+		BlockIndexEntry entry = { 0, 0, 0 };
+
+		for (int j = 0; j < 8; j++)
+		{
+			entry.compressedOffset |= (unsigned long long)in[j] << (8 * j);
+			entry.rawOffset |= (unsigned long long)in[8 + j] << (8 * j);
+			entry.bits |= (unsigned long long)in[16 + j] << (8 * j);
+		}
+
+		unsigned long long lastCompressed = index.empty() ? 6 : index.back().compressedOffset;
+		unsigned long long lastRaw = index.empty() ? 0 : index.back().rawOffset;
+
+		bool valid = entry.compressedOffset > lastCompressed && entry.compressedOffset < indexStart && entry.rawOffset <= rawSize
+			&& (index.empty() ? entry.rawOffset == 0 : entry.rawOffset > lastRaw && entry.rawOffset - lastRaw <= fileBlockSize);
+
+		if (!valid) return false;
+
+		index.push_back(entry);
+	}
+
+	return index.empty() ? rawSize == 0 : rawSize > index.back().rawOffset && rawSize - index.back().rawOffset <= fileBlockSize; // Last block must end the file
+}
+
+bool Huffman::decodeIndexedBlocks(string inputFile, string outputFile, const vector<BlockIndexEntry>& index, unsigned long long rawSize)
+{
+	/* [Private Method]
+	* Decodes every block listed in index on a thread pool, each one written straight to its place in outputFile.
+	*
+	* When they can be memory mapped, inputFile is mapped for reading and outputFile is set to rawSize and mapped
+	* for writing, so each block is decoded from one mapping straight into the other. Otherwise outputFile is
+	* resized to rawSize, and each worker reads and writes through its own handles on the files.
+	*
+	* Each worker has its own Huffman object to hold the decode tables, so workers never wait on each other once
+	* they have a block. A block whose header doesn't match the index, or that doesn't decode, marks the file as
+	* corrupt, which is reported once every worker has finished. Returns false if the file was corrupt.
+	*/
+
+	MappedFile mappedInput;
+	MappedFile mappedOutput;
+	bool inputMapped = useMapping && mappedInput.openRead(inputFile);
+	bool outputMapped = useMapping && mappedOutput.openWrite(outputFile, rawSize);
+
+	if (!outputMapped) filesystem::resize_file(outputFile, rawSize);
+
+	struct DecodeWorker
+	{
+		Huffman coder;
+		ifstream input;
+		fstream output;
+		vector<unsigned char> payload;
+		vector<unsigned char> out;
+	};
+
+	DecodeWorker* workers = new DecodeWorker[threads];
+
+	for (int i = 0; i < threads; i++)
+	{
+		if (!inputMapped) workers[i].input.open(inputFile, ios::binary);
+		if (!outputMapped)
+		{
+			workers[i].output.open(outputFile, ios::binary | ios::in | ios::out);
+			workers[i].out.resize(fileBlockSize);
+		}
+	}
+
+	atomic<bool> corrupt(false);
+	vector<future<void>> done;
+	ThreadPool pool(threads);
+
+	for (size_t block = 0; block < index.size(); block++)
+	{
+		done.push_back(pool.submit([&, block](int worker)
+		{
+			DecodeWorker& w = workers[worker];
+			const BlockIndexEntry& entry = index[block];
+			unsigned char* out = outputMapped ? mappedOutput.data() + entry.rawOffset : w.out.data();
+			size_t rawLength;
+
+			if (!w.coder.decodeIndexedBlock(index, block, rawSize, inputMapped ? &mappedInput : nullptr, w.input, w.payload, out, rawLength))
+			{
+				corrupt = true;
+				return;
+			}
+
+			if (!outputMapped)
+			{
+				w.output.seekp(entry.rawOffset);
+				w.output.write((char*)out, rawLength);
+			}
+		}));
+	}
+
+	for (size_t i = 0; i < done.size(); i++) done[i].get();
+
+	for (int i = 0; i < threads; i++) stats.add(workers[i].coder.stats);
+	stats.bytesOut = rawSize;
+
+	delete[] workers;
+
+	if (corrupt) cout << "Corrupt block in file" << endl;
+
+	return !corrupt;
+}
+
+bool Huffman::decodeIndexedBlock(const vector<BlockIndexEntry>& index, size_t block, unsigned long long rawSize, MappedFile* mappedInput, ifstream& input, vector<unsigned char>& payloadBuffer, unsigned char* out, size_t& rawLength)
+{
+	/* [Private Method]
+	* Finds block number block of a file through its seek index, and decodes it into out (which must have room
+	* for fileBlockSize bytes), setting rawLength to the number of bytes decoded. The record is read from
+	* mappedInput if it isn't nullptr, otherwise from input into payloadBuffer.
+	*
+	* Returns false if the record's header doesn't match the index (its bytes must run right up to the next
+	* block's, or to rawSize for the last one), if it runs off the end of the file, or if it doesn't decode.
+	*/
+
+	const BlockIndexEntry& entry = index[block];
+
+	unsigned char header[BLOCK_HEADER_SIZE] = { 0 };
+	size_t headerRead;
+
+	if (mappedInput != nullptr)
+	{
+		headerRead = entry.compressedOffset + BLOCK_HEADER_SIZE <= mappedInput->size() ? BLOCK_HEADER_SIZE : 0;
+		if (headerRead > 0) copy(mappedInput->data() + entry.compressedOffset, mappedInput->data() + entry.compressedOffset + BLOCK_HEADER_SIZE, header);
+	}
+	else
+	{
+		input.clear();
+		input.seekg(entry.compressedOffset);
+		input.read((char*)header, BLOCK_HEADER_SIZE);
+		headerRead = input.gcount();
+	}
+
+	size_t payloadLength;
+	readRecordHeader(header, rawLength, payloadLength);
+
+	unsigned long long rawEnd = block + 1 < index.size() ? index[block + 1].rawOffset : rawSize; // Where the next block starts
+
+	if (headerRead != BLOCK_HEADER_SIZE || rawLength == 0 || entry.rawOffset + rawLength != rawEnd || (entry.bits + 7) / 8 > payloadLength) return false;
+
+	const unsigned char* payload;
+	size_t payloadRead;
+
+	if (mappedInput != nullptr)
+	{
+		size_t payloadStart = entry.compressedOffset + BLOCK_HEADER_SIZE;
+		payloadRead = min(payloadLength, mappedInput->size() - payloadStart);
+		payload = mappedInput->data() + payloadStart;
+	}
+	else
+	{
+		payloadBuffer.resize(payloadLength);
+		input.read((char*)payloadBuffer.data(), payloadLength);
+		payloadRead = input.gcount();
+		payload = payloadBuffer.data();
+	}
+
+	stats.bytesIn += BLOCK_HEADER_SIZE + payloadRead;
+
+	return payloadRead == payloadLength && decodeBlock(payload, payloadLength, header[4], out, rawLength);
+}
+
+HuffmanStatus Huffman::decodeRange(string inputFile, string outputFile, long long offset, unsigned long long length)
+{
+	/* [Public Method]
+	* Decodes only the length bytes starting at offset of the file inputFile holds, and writes them to
+	* outputFile (or to stdout if outputFile is "-", with the summary going to stderr instead). A negative
+	* offset counts back from the end, so the last n bytes are offset -n. The range is cut off at the end
+	* of the file.
+	*
+	* The seek index at the end of a block file says where every block starts in both files, so only the
+	* blocks overlapping the range are read and decoded, found with a binary search. Reading the end of a
+	* huge file costs about as much as decoding one block.
+	*
+	* Returns HUFFMAN_NO_FILE if inputFile can't be opened, HUFFMAN_UNSUPPORTED if it isn't a block file with
+	* a seek index, or HUFFMAN_CORRUPT if its header or a block it needs is damaged, in which case outputFile
+	* is removed rather than left half written. Otherwise returns HUFFMAN_OK. Errors go to stderr when the
+	* range is written to stdout.
+	*/
+
+	auto start = std::chrono::steady_clock::now(); // Used to get total elapsed time
+	stats = HuffmanStats();
+
+	bool toConsole = outputFile == "-";
+	ostream& messages = toConsole ? cerr : cout; // Keeps errors out of the decoded bytes
+
+	ifstream input(inputFile, ios::binary);
+
+	if (!input.is_open())
+	{
+		messages << "Unable to open file: " << inputFile << endl;
+		return HUFFMAN_NO_FILE;
+	}
+
+	int version = readHeader(input, messages);
+
+	if (version < 0) return HUFFMAN_CORRUPT;
+
+	if (version != BLOCK_FORMAT)
+	{
+		messages << "Only block files can be decoded by range" << endl;
+		return HUFFMAN_UNSUPPORTED;
+	}
+
+	vector<BlockIndexEntry> index;
+	unsigned long long rawSize;
+
+	if (!readIndex(input, index, rawSize))
+	{
+		messages << "File has no seek index, can't decode by range: " << inputFile << endl;
+		return HUFFMAN_UNSUPPORTED;
+	}
+
+	unsigned long long first = offset < 0 ? rawSize - min(rawSize, (unsigned long long)-offset) : min(rawSize, (unsigned long long)offset);
+	unsigned long long last = first + min(length, rawSize - first); // One past the last byte wanted
+
+	ofstream outputFileStream;
+	if (!toConsole) outputFileStream.open(outputFile, ios::binary);
+	ostream& output = toConsole ? cout : outputFileStream;
+
+	MappedFile mappedInput;
+	bool inputMapped = useMapping && mappedInput.openRead(inputFile);
+
+	vector<unsigned char> payloadBuffer;
+	vector<unsigned char> out(fileBlockSize);
+
+	size_t block = upper_bound(index.begin(), index.end(), first, [](unsigned long long rawOffset, const BlockIndexEntry& entry) { return rawOffset < entry.rawOffset; }) - index.begin();
+	if (block > 0) block--; // The block holding first is the last one starting at or before it
+
+	for (; block < index.size() && index[block].rawOffset < last; block++)
+	{
+		size_t rawLength;
+
+		if (!decodeIndexedBlock(index, block, rawSize, inputMapped ? &mappedInput : nullptr, input, payloadBuffer, out.data(), rawLength))
+		{
+			messages << "Corrupt block in file" << endl;
+			output.flush();
+
+			if (!toConsole) // Don't leave a half-decoded range behind
+			{
+				outputFileStream.close();
+				error_code error;
+				filesystem::remove(outputFile, error);
+			}
+			return HUFFMAN_CORRUPT;
+		}
+
+		unsigned long long from = max(first, index[block].rawOffset); // The part of this block inside the range
+		unsigned long long to = min(last, index[block].rawOffset + rawLength);
+
+		STATS_START(writeStart);
+		output.write((char*)out.data() + (from - index[block].rawOffset), to - from);
+		STATS_STOP(ioNs, writeStart);
+	}
+
+	output.flush();
+
+	stats.bytesOut = last - first;
+	report("decode", start, messages);
+
+	return HUFFMAN_OK;
+}
+
+HuffmanStatus Huffman::decodeRange(span<const unsigned char> input, unsigned long long offset, unsigned long long length, vector<unsigned char>& output)
+{
+	/* [Public Method]
+	* Decodes only the length bytes starting at offset of the block file held in input into output,
+	* replacing what output held. Like decodeRange on a file, the seek index is used to find and decode
+	* only the blocks overlapping the range, and the range is cut off at the end of the file.
+	*
+	* Returns HUFFMAN_OK, HUFFMAN_UNSUPPORTED if input isn't a block file with a seek index, or
+	* HUFFMAN_CORRUPT if the blocks needed are damaged. output is cleared on error.
+	*/
+
+	stats = HuffmanStats();
+	output.clear();
+
+	if (input.size() < 7 || input[0] != 'H' || input[1] != 'F' || input[2] != BLOCK_FORMAT) return HUFFMAN_UNSUPPORTED;
+
+	fileBlockSize = 0;
+	for (int i = 0; i < 4; i++) fileBlockSize |= (size_t)input[3 + i] << (8 * i);
+	if (fileBlockSize == 0 || fileBlockSize > MAX_BLOCK_SIZE) return HUFFMAN_CORRUPT;
+
+	vector<BlockIndexEntry> index;
+	unsigned long long rawSize;
+	if (!readIndex(input, index, rawSize)) return HUFFMAN_UNSUPPORTED;
+
+	unsigned long long first = min(rawSize, offset);
+	unsigned long long last = first + min(length, rawSize - first);
+
+	output.resize(last - first);
+	vector<unsigned char> out(fileBlockSize);
+
+	size_t block = upper_bound(index.begin(), index.end(), first, [](unsigned long long rawOffset, const BlockIndexEntry& entry) { return rawOffset < entry.rawOffset; }) - index.begin();
+	if (block > 0) block--;
+
+	for (; block < index.size() && index[block].rawOffset < last; block++)
+	{
+		const BlockIndexEntry& entry = index[block];
+		unsigned long long rawEnd = block + 1 < index.size() ? index[block + 1].rawOffset : rawSize;
+
+		size_t rawLength, payloadLength;
+		const unsigned char* header = input.data() + entry.compressedOffset;
+		readRecordHeader(header, rawLength, payloadLength);
+
+		size_t payloadStart = entry.compressedOffset + BLOCK_HEADER_SIZE;
+
+		if (rawLength == 0 || entry.rawOffset + rawLength != rawEnd || payloadLength > input.size() - payloadStart
+			|| !decodeBlock(input.data() + payloadStart, payloadLength, header[4], out.data(), rawLength))
+		{
+			output.clear();
+			return HUFFMAN_CORRUPT;
+		}
+
+		unsigned long long from = max(first, entry.rawOffset);
+		unsigned long long to = min(last, entry.rawOffset + rawLength);
+		copy(out.data() + (from - entry.rawOffset), out.data() + (to - entry.rawOffset), output.data() + (from - first));
+		stats.bytesIn += BLOCK_HEADER_SIZE + payloadLength;
+	}
+
+	stats.bytesOut = last - first;
+
+	return HUFFMAN_OK;
+}
@@ -11,10 +11,72 @@ The header for Huffman.cpp
 */
 
 #include "HNode.h"
+#include "MappedFile.h"
+#include "Stats.h"
+#include "BitIO.h"
+#include <fstream>
+#include <vector>
+#include <span>
+#include <functional>
 #pragma once
 
+#define DECODE_BITS 11 // Number of bits resolved by a single decode table lookup
+#define MAX_CODE_LENGTH 63 // Longest code a canonical file can hold
+#define BLOCK_MAX_CODE_LENGTH 32 // Longest code a block can hold
+
+#define LEGACY_FORMAT 0 // File starts with a 510-byte pairOrder header
+#define STREAM_FORMAT 2 // Version byte after "HF": one canonical stream for the whole file
+#define BLOCK_FORMAT 3 // Version byte after "HF": independently encoded blocks
+
+#define BLOCK_HEADER_SIZE 9 // Raw length, block type, payload length
+#define BLOCK_HUFFMAN 0 // Block type: length table followed by huffman coded bits
+#define BLOCK_HUFFMAN4 1 // Block type: length table, jump table, then BLOCK_STREAMS huffman coded substreams
+#define BLOCK_STORED 2 // Block type: the raw bytes, for data huffman codes can't shrink
+#define BLOCK_RLE 3 // Block type: a single byte, repeated for the whole block
+#define BLOCK_CONTEXT 4 // Block type: a table per cluster of previous bytes, the map to them, then the coded bits
+#define CONTEXT_MAX_TABLES 16 // Most tables a BLOCK_CONTEXT block can have, so the map fits in a nibble per context
+#define BLOCK_STREAMS 4 // Substreams in a BLOCK_HUFFMAN4 block
+#define INDEX_ENTRY_SIZE 24 // Record offset, decoded offset, bitstream length
+#define INDEX_FOOTER_SIZE 16 // Decoded size, number of blocks, "HFIX"
+#define LENGTH_TABLE_SIZE (1 + 32 + 1 + 256) // Largest a length table can be
+#define DEFAULT_BLOCK_SIZE (1 << 20)
+#define MIN_BLOCK_SIZE (1 << 10)
+#define MAX_BLOCK_SIZE (1 << 30)
+#define HISTOGRAM_SAMPLE_MIN (1 << 14) // Fewest bytes a block's sample may hold, blocks too small for that are counted in full
+#define SAMPLE_CHECK_BYTES 4096 // Bytes of a sampled block encoded between checks that it hasn't outgrown the block
+#define PIPELINE_SLOTS 4 // Blocks in flight between the reader, the coder and the writer on one thread
+
 using namespace std;
 
+class ThreadPool; // ThreadPool.h
+struct ByteCounts; // Histogram.h
+
+enum HuffmanStatus // Results of encode and decode
+{
+	HUFFMAN_OK = 0,
+	HUFFMAN_CORRUPT, // Input is damaged
+	HUFFMAN_UNSUPPORTED, // Input isn't a format decode can read
+	HUFFMAN_NO_SPACE, // Output buffer is too small (only for calls that write into the caller's buffer)
+	HUFFMAN_NO_FILE, // Input file couldn't be opened
+	HUFFMAN_FAILED // Something else went wrong, like running out of memory or a filesystem error
+};
+
+struct HuffmanEstimate // What encoding an input would come to, worked out by estimateFile and estimate without encoding it
+{
+	unsigned long long bytesIn = 0;
+	unsigned long long bytesOut = 0; // Size of the encoded file, exact unless sampled or upperBound is set
+	bool sampled = false; // Some blocks' counts came from a sample (setHistogramStride), so bytesOut is an estimate
+	bool upperBound = false; // setContextTables was on, which only ever makes blocks smaller, so bytesOut is the most the file could take
+	double entropy = 0; // Order-0 entropy of the input in bits per byte. bytesIn * entropy / 8 is the least one code table could take
+	unsigned long long blocks = 0;
+	unsigned long long storedBlocks = 0; // Blocks huffman codes can't shrink, which are stored as they are
+	unsigned long long tableBytes = 0; // Part of bytesOut taken by the blocks' length tables
+	int longestCode = 0; // Longest code any block uses
+	unsigned long long decodeTableBytes = 0; // Most memory the decoder's lookup table and tree take for any one block
+	unsigned long long slowBytes = 0; // Bytes with codes longer than DECODE_BITS, which take more than one lookup to decode
+	HuffmanStatus status = HUFFMAN_OK; // HUFFMAN_NO_FILE if estimateFile couldn't open its input, in which case the rest is 0
+};
+
  class Huffman
 {
 public:
@@ -23,25 +85,139 @@ public:
 	~Huffman(); // Destructor
 
 	void makeTreeBuilder(string inputFile, string outputFile = "");
-	void encodeFile(string inputFile, string outputFile = "");
-	void decodeFile(string inputFile, string outputFile);
+	void makeSharedTable(const vector<string>& inputFiles, string outputFile, size_t sampleFiles = 0); // Trains one code table over many files, for SharedTable
+	HuffmanStatus encodeFile(string inputFile, string outputFile = "");
+	HuffmanStatus decodeFile(string inputFile, string outputFile);
 	void encodeFileWithTree(string inputFile, string treeFile, string outputFile = "");
+	void encodeStream(istream& input, ostream& output); // Encodes input to output in one pass, for pipes
+	HuffmanStatus decodeStream(istream& input, ostream& output); // Decodes a block file from input to output in one pass
+	HuffmanStatus encodeFiles(const vector<string>& inputFiles); // Encodes many files at once, each to its name + .huf
+	HuffmanStatus decodeFiles(const vector<string>& inputFiles); // Decodes many .huf files at once, each to its name without .huf
+	HuffmanStatus encode(span<const unsigned char> input, vector<unsigned char>& output); // Encodes a buffer into a block file
+	HuffmanStatus decode(span<const unsigned char> input, vector<unsigned char>& output); // Decodes a block file held in a buffer
+	HuffmanStatus decodeRange(string inputFile, string outputFile, long long offset, unsigned long long length); // Decodes only length bytes from offset (negative counts from the end)
+	HuffmanStatus decodeRange(span<const unsigned char> input, unsigned long long offset, unsigned long long length, vector<unsigned char>& output); // Same, for a block file in a buffer
+	HuffmanEstimate estimateFile(string inputFile); // Works out what encodeFile would write for inputFile without writing anything, and prints it
+	HuffmanEstimate estimate(span<const unsigned char> input); // Works out what encode would write for input, without printing
+	void setMaxCodeLength(int maxLength); // Longest code encodeFile may use
+	void setBlockSize(size_t size); // Number of input bytes in each block encodeFile writes
+	void setThreads(int count); // Number of threads encodeFile and decodeFile use
+	void setStreams(int count); // Number of interleaved substreams in each block, 1 or BLOCK_STREAMS
+	void setContextTables(int count); // Code each byte with a table picked by the byte before it, from up to count tables (0 turns it off)
+	void setHistogramStride(size_t stride); // Build each block's codes from the counts of 1 in every stride runs of its bytes (1 counts them all)
+	void setMemoryMapping(bool enabled); // Whether files may be memory mapped instead of streamed
+	void setStatsJson(bool enabled); // Print the summary after each file as JSON
+	const HuffmanStats& getStats(); // Counters from the last file or buffer
 
 private:
 
+	friend class HuffmanBenchmark; // Times the private phases of encoding one at a time (Benchmark.cpp)
+	friend class SharedTable; // Compiles a trained table once with the private table builders (SharedTable.cpp)
+	friend class HuffmanGenerator; // Rebuilds a tree building file's tree to bake its tables into a header (HGen.cpp)
+
 	void countChar(string inputFile); // Updates charCounts[] based on input file
-	void initTree(string inputFile); // Builds huffman tree based on node weights
-	void rebuildTree(string inputFile); // Rebuilds tree from 510-byte string
-	void buildCipher(string path = "", HNode* traverse  = nullptr); // Acquires the char path codes from the tree
-	void writeCodeToFile(string inputFile, string outputFile); // Called by encodeFile and encodeFileWithTree to output code to file
+	void countInput(FileReader& input, ThreadPool* pool); // Adds the rest of input to charCounts[], on pool's workers if there is one
+	unsigned long long readChunks(FileReader& input, ThreadPool* pool, function<void(const unsigned char*, size_t, int)> task); // Calls task on every chunk of input, on pool's workers if there is one
+	void initTree(bool allBytes = false); // Builds huffman tree based on node weights
+	bool rebuildTree(string inputFile); // Rebuilds tree from 510-byte string
+	void buildCipher(int node = -1, int depth = 0); // Acquires the char path codes from the tree
+	void writeCodeToFile(string inputFile, string outputFile); // Called by encodeFileWithTree to output code to file
+	unsigned long long encodeBlock(const unsigned char* data, size_t length, vector<unsigned char>& out); // Appends data to out as one encoded block, returns its length in bits
+	bool countBlock(const unsigned char* data, size_t length, unsigned long long streamCounts[BLOCK_STREAMS][256], size_t& sampleLength); // Fills charCounts[] for encodeBlock, returns true if every byte is the same
+	double entropyBound(size_t length, size_t sampleLength, int& present); // Fewest bits any code for charCounts[] could take
+	void estimateBlock(const unsigned char* data, size_t length, HuffmanEstimate& estimate, unsigned long long counts[256]); // Adds what encodeBlock would write for data to estimate
+	void finishEstimate(HuffmanEstimate& estimate, const vector<HuffmanEstimate>& parts, const vector<ByteCounts>& counts); // Adds up each worker's estimate and the file's overhead
+	void reportEstimate(const HuffmanEstimate& estimate, std::chrono::steady_clock::time_point start); // Prints an estimate
+	unsigned long long writeSampledRecord(const unsigned char* data, size_t length, const unsigned char* table, int tableSize, vector<unsigned char>& out); // Finishes encodeBlock for codes built from a sample, whose size isn't known ahead
+	unsigned long long storeBlock(const unsigned char* data, size_t length, int type, vector<unsigned char>& out); // Appends data to out as a BLOCK_STORED or BLOCK_RLE record
+	bool decodeBlock(const unsigned char* payload, size_t payloadLength, int type, unsigned char* out, size_t rawLength); // Decodes one block's payload into out
+	bool decodeBits(BitReader& reader, unsigned char* out, size_t outLength); // Decodes outLength bytes from a bitstream in memory
+	bool decodeStreams(const unsigned char* in, size_t inLength, unsigned char* out, size_t outLength); // Decodes a BLOCK_HUFFMAN4 block's substreams in lockstep
+	unsigned long long encodeBlocks(FileReader& input, ostream& output); // Encodes input as a BLOCK_FORMAT file, returns the bytes encoded
+	bool decodeBlocks(string inputFile, istream& input, ostream& output); // Decodes every block of a BLOCK_FORMAT file
+	void readRecordHeader(const unsigned char header[BLOCK_HEADER_SIZE], size_t& rawLength, size_t& payloadLength); // Reads the lengths out of a block record's header
+	void decodeBitstream(ifstream& input, ofstream& output, unsigned long long symbolsLeft); // Decodes a single bitstream running to the end of input
 	void rebuildPairOrder(string inputFile); // rebuilds pairOrder[] based on the first 510 bytes of target file.
-	void tearDown(HNode* traverse = nullptr);
-	HNode* getMinNode(HNode* exclude = nullptr);
+	int popMinNode(int heap[], int& heapSize); // Removes the lowest weighted node from a heap of node indices
+	void pushNode(int heap[], int& heapSize, int node); // Adds a node index to the heap
+	bool nodeLess(int a, int b); // Heap order: weight, then key
+	void limitCodeLengths(int limit); // Rebuilds codeLengths[] with package-merge if any code is over limit
+	void assignCanonicalCodes(); // Fills the cipher arrays with canonical codes based on codeLengths[]
+	int writeLengthTable(unsigned char* out); // Writes codeLengths[] to out, returns the number of bytes used
+	int readLengthTable(const unsigned char* in, size_t available); // Reads codeLengths[] from in, returns the number of bytes used or -1
+	int readHeader(istream& input, ostream& messages); // Reads a file's header, returns its format (-1 if it is damaged, saying why on messages)
+	void compileDecoderFromLengths(); // Compiles codeLengths[] into decodeTable[] and decodeNodes[] without building a tree
+	void compileDecoder(); // Compiles the tree into decodeTable[] and decodeNodes[]
+	int flattenTree(int node, int& flatCount); // Copies the tree into decodeNodes[], returns the index node was given
+	void fillDecodeTable(int node, int depth, unsigned int prefix); // Fills decodeTable[] with every code reachable from node
+
+	struct BlockIndexEntry
+	{
+		unsigned long long compressedOffset; // Where the block's record starts in the encoded file
+		unsigned long long rawOffset; // Where the block's bytes start in the decoded file
+		unsigned long long bits; // Length of the block's bitstream, not counting padding
+	};
+
+	void writeIndex(vector<unsigned char>& output, const vector<BlockIndexEntry>& index, unsigned long long rawSize); // Appends the seek index that ends a BLOCK_FORMAT file
+	bool readIndex(ifstream& input, vector<BlockIndexEntry>& index, unsigned long long& rawSize); // Reads the seek index, returns false if there isn't a valid one
+	bool readIndex(span<const unsigned char> input, vector<BlockIndexEntry>& index, unsigned long long& rawSize); // Same, for a block file in memory
+	bool parseIndex(const unsigned char* entries, unsigned long long count, unsigned long long indexStart, unsigned long long rawSize, vector<BlockIndexEntry>& index); // Reads and checks the index entries
+	bool decodeIndexedBlock(const vector<BlockIndexEntry>& index, size_t block, unsigned long long rawSize, MappedFile* mappedInput, ifstream& input, vector<unsigned char>& payloadBuffer, unsigned char* out, size_t& rawLength); // Finds and decodes one block through the index
+	HuffmanStatus codeFiles(const vector<string>& inputFiles, bool decoding); // Shares inputFiles out between the threads for encodeFiles and decodeFiles
+	void report(string mode, std::chrono::steady_clock::time_point start, ostream& console); // Prints the summary of the last file
+	bool decodeIndexedBlocks(string inputFile, string outputFile, const vector<BlockIndexEntry>& index, unsigned long long rawSize); // Decodes the blocks in parallel
+
+	struct DecodeEntry
+	{
+		unsigned short symbol; // Decoded byte, or the decodeNodes[] index to keep walking from if length is 0
+		unsigned char length; // Number of bits the code takes up. 0 means the code is longer than DECODE_BITS
+	};
 
-	HNode* leaves[256]; // Leaf for every possible character
-	string charCipher[256];
+	inline int decodeSymbol(BitReader& reader, const DecodeEntry* table, const short (*tableNodes)[2]); // Decodes one code that is entirely in reader's buffer
+	bool encodeContextBlock(const unsigned char* data, size_t length, vector<unsigned char>& out, double order0Bits, unsigned long long& bits); // Appends data as a BLOCK_CONTEXT record if that beats order-0
+	int clusterContexts(); // Groups the contexts in contextCounts into up to contextTables tables, returns how many
+	bool decodeContextBlock(const unsigned char* payload, size_t payloadLength, unsigned char* out, size_t rawLength); // Decodes a BLOCK_CONTEXT payload
+	bool decodeContextBits(BitReader& reader, unsigned char* out, size_t outLength); // Decodes outLength bytes, picking each one's table by the byte before it
+
+	HNode nodes[511]; // The tree. nodes[0-255] are the leaf for every possible character, parents are placed after them
+	int nodeCount; // Number of nodes in use
+	unsigned int cipherCode[256]; // Path to each leaf, right-aligned. Only used for paths of up to 32 bits
+	unsigned char cipherLength[256]; // Length of the path to each leaf
+	unsigned long long longCipher[256][4]; // Paths over 32 bits, left-aligned across all 4 words
+	unsigned long long cipherPath[4]; // Path taken so far, used by buildCipher()
+	unsigned char codeLengths[256]; // Canonical code length of each byte, 0 if the byte has no code
+	unsigned long long symbolCount; // Number of bytes in the file being encoded/decoded
+	unsigned long long charCounts[256]; // Number of times each byte appears in the file being encoded
+	int maxCodeLength; // Longest code encodeFile may give a byte
+	size_t blockSize; // Number of input bytes in each block
+	size_t fileBlockSize; // Block size read from the header of the file being decoded, kept apart from blockSize so decoding doesn't change how the object encodes
+	int threads; // Number of threads used to encode or decode blocks
+	bool useMapping; // Whether files may be memory mapped
+	bool jsonStats; // Whether report prints JSON
+	bool quiet; // Whether report prints anything, turned off for the coders in batch mode
+	bool pipelined; // Whether blocks are read and written on their own threads while they are coded, turned off for the coders in batch mode
+	int streams; // Substreams in each block encodeBlock writes
+	int contextTables; // Most tables a BLOCK_CONTEXT block may use, 0 to only write order-0 blocks
+	size_t histogramStride; // encodeBlock counts 1 in every histogramStride runs of each block, 1 to count every byte
+	HuffmanStats stats; // Counters for the file or buffer being coded
+	unsigned long long unlimitedBits; // Bits the blocks shortened by limitCodeLengths would have taken without the limit...
+	unsigned long long limitedBits; // ... and the bits they take with it
 	unsigned char pairOrder[510]; // Used to keep track of how the nodes are paired. (Saved as a header to file.huff)
-	HNode* root;
+	int root; // Index of the root in nodes[], -1 if there is no tree
+
+	vector<BlockIndexEntry> indexScratch; // Index built by encode, kept so its memory is reused from call to call
+	vector<unsigned char> recordScratch; // Record writeSampledRecord writes before it is copied to out, kept so it is only zero-filled once
+
+	DecodeEntry decodeTable[1 << DECODE_BITS]; // Resolves the next DECODE_BITS bits of the stream in one lookup
+	short decodeNodes[511][2]; // Flat copy of the tree's internal nodes. Children >= 0 are node indices, children < 0 are leaves holding ~key
+
+	vector<unsigned int> contextCounts; // Times each byte follows each byte in the block, [previous * 256 + byte]
+	vector<unsigned long long> clusterCounts; // Summed counts of each table's contexts, [table * 256 + byte]
+	unsigned char contextMap[256]; // Table used after each byte
+	vector<unsigned int> contextCodes; // Each table's canonical codes, [table * 256 + byte]
+	vector<unsigned char> contextLengths; // ... and their lengths
+	vector<DecodeEntry> contextDecodeTables; // decodeTable[] of each table, back to back
+	vector<short> contextDecodeNodes; // decodeNodes[] of each table, back to back
 
 };
 
@@ -0,0 +1,199 @@
+/*
+MappedFile.cpp
+
+Maps a whole file into memory, so encoding and decoding can work straight on the page cache
+instead of copying the file through stream buffers.
+
+Only regular files can be mapped. Pipes, devices, and anything on a platform without mmap make
+openRead/openWrite return false, and callers fall back to reading through a stream. FileReader
+wraps up that choice for code that reads a file front to back.
+
+*/
+
+#include "MappedFile.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() // Constructor
+{
+	base = nullptr;
+	length = 0;
+	fd = -1;
+}
+
+MappedFile::~MappedFile() // Destructor
+{
+	close();
+}
+
+bool MappedFile::openRead(string path)
+{
+	/* [Public Method]
+	* Maps path read-only, and tells the kernel it will be read front to back so it can read ahead.
+	* An empty file opens fine, with data() returning nullptr and size() returning 0.
+	*/
+
+	close();
+
+#ifdef _WIN32
+	return false;
+#else
+	struct stat info; // Checked before opening, since opening a pipe would take its data away from the stream fallback
+	if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) return false;
+
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0 || fstat(fd, &info) != 0)
+	{
+		close();
+		return false;
+	}
+
+	length = info.st_size;
+	if (length == 0) return true;
+
+	void* mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+
+	base = (unsigned char*)mapping;
+	madvise(base, length, MADV_SEQUENTIAL);
+	return true;
+#endif
+}
+
+bool MappedFile::openWrite(string path, size_t size)
+{
+	/* [Public Method]
+	* Creates (or truncates) path, sets it to size bytes, and maps it for writing. Whatever is written to
+	* data() ends up in the file once it is closed.
+	*/
+
+	close();
+
+#ifdef _WIN32
+	return false;
+#else
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return false;
+
+	if (ftruncate(fd, size) != 0)
+	{
+		close();
+		return false;
+	}
+
+	length = size;
+	if (length == 0) return true;
+
+	void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+
+	base = (unsigned char*)mapping;
+	madvise(base, length, MADV_SEQUENTIAL);
+	return true;
+#endif
+}
+
+void MappedFile::close()
+{
+	/* [Public Method]
+	* Unmaps the file and closes it. Safe to call when nothing is open.
+	*/
+
+#ifndef _WIN32
+	if (base != nullptr) munmap(base, length);
+	if (fd >= 0) ::close(fd);
+#endif
+
+	base = nullptr;
+	length = 0;
+	fd = -1;
+}
+
+unsigned char* MappedFile::data()
+{
+	return base;
+}
+
+size_t MappedFile::size()
+{
+	return length;
+}
+
+FileReader::FileReader(size_t chunkSize, bool allowMapping) // Constructor
+{
+	this->chunkSize = chunkSize;
+	this->allowMapping = allowMapping;
+	mapping = false;
+	offset = 0;
+	stream = &file;
+}
+
+bool FileReader::open(string path)
+{
+	/* [Public Method]
+	* Maps path when allowed and possible. Otherwise opens it as a stream, which works for any kind of file.
+	*/
+
+	offset = 0;
+	mapping = allowMapping && mapped.openRead(path);
+	if (mapping) return true;
+
+	file.open(path, ios::binary);
+	stream = &file;
+	return file.is_open();
+}
+
+void FileReader::open(istream& source)
+{
+	/* [Public Method]
+	* Reads chunks from source, which is never mapped.
+	*/
+
+	offset = 0;
+	mapping = false;
+	stream = &source;
+}
+
+size_t FileReader::next(const unsigned char*& chunk, unsigned char* buffer)
+{
+	/* [Public Method]
+	* Hands out the next chunkSize bytes of the file (fewer at the end, 0 once it has all been read).
+	*
+	* When the file is mapped, chunk points straight into the mapping and buffer is untouched. Otherwise the
+	* bytes are read into buffer, which must hold chunkSize bytes, and chunk points at it. Either way chunk stays
+	* valid until buffer is reused or the reader is destroyed, so callers can keep several chunks in flight by
+	* passing a different buffer each time.
+	*/
+
+	if (mapping)
+	{
+		size_t length = mapped.size() - offset;
+		if (length > chunkSize) length = chunkSize;
+
+		chunk = mapped.data() + offset;
+		offset += length;
+		return length;
+	}
+
+	stream->read((char*)buffer, chunkSize);
+	chunk = buffer;
+	return stream->gcount();
+}
+
+bool FileReader::isMapped()
+{
+	return mapping;
+}
@@ -0,0 +1,58 @@
+/*
+MappedFile.h
+
+The header for MappedFile.cpp
+
+*/
+
+#include <string>
+#include <fstream>
+#include <cstddef>
+#pragma once
+
+using namespace std;
+
+class MappedFile
+{
+public:
+
+	MappedFile(); // Constructor
+	~MappedFile(); // Destructor, unmaps the file
+
+	bool openRead(string path); // Maps a regular file for reading, returns false if it can't be mapped
+	bool openWrite(string path, size_t size); // Sets a file to size bytes and maps it for writing, returns false if it can't be mapped
+	void close(); // Unmaps the file
+
+	unsigned char* data(); // Start of the mapping
+	size_t size(); // Number of bytes mapped
+
+private:
+
+	unsigned char* base; // Start of the mapping, nullptr if nothing (or an empty file) is mapped
+	size_t length; // Number of bytes mapped
+	int fd; // Descriptor of the mapped file, -1 if none
+
+};
+
+class FileReader
+{
+public:
+
+	FileReader(size_t chunkSize, bool allowMapping = true); // Reads chunks of up to chunkSize bytes
+
+	bool open(string path); // Maps path if it can, otherwise opens it as a stream. Returns false if it can't be opened at all
+	void open(istream& source); // Reads from an already open stream, like cin
+	size_t next(const unsigned char*& chunk, unsigned char* buffer); // Points chunk at the next bytes of the file, returns how many (0 at the end)
+	bool isMapped(); // True if the file is being read straight from memory
+
+private:
+
+	MappedFile mapped;
+	ifstream file; // Used when the file can't be mapped
+	istream* stream; // Where chunks are read from when not mapping, file or a stream given to open
+	bool mapping; // True if reading from mapped
+	bool allowMapping;
+	size_t chunkSize;
+	size_t offset; // Bytes of mapped handed out so far
+
+};
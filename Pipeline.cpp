@@ -0,0 +1,162 @@
+/*
+Pipeline.cpp
+
+Runs reading, coding and writing at the same time, so the CPU isn't left waiting on the disk
+and the disk isn't left waiting on the CPU.
+
+The caller owns a fixed set of buffers ("slots"), and the pipeline only moves slot numbers around:
+a reader thread fills free slots, the calling thread codes them, and a writer thread writes them out
+and hands them back to the reader. Each hand-off is a SlotQueue with exactly one thread on each end,
+so it needs no lock, just two counters. A thread only sleeps when its queue is empty (or full), on
+C++20's atomic wait, which costs nothing while the stages keep up with each other.
+
+With enough slots, the whole run takes about as long as the slowest stage rather than all three
+added up.
+
+*/
+
+#include "Pipeline.h"
+
+SlotQueue::SlotQueue(size_t capacity) // Constructor
+{
+	ring.resize(capacity);
+	head = 0;
+	tail = 0;
+}
+
+void SlotQueue::push(size_t slot)
+{
+	/* [Public Method]
+	* Adds slot at the back of the queue. If the queue is full, sleeps until the consumer pops one.
+	*
+	* The slot number is stored before tail is moved (with release), so the consumer, which reads tail with
+	* acquire, always sees it, along with anything else the producer wrote to the slot's buffers first.
+	*/
+
+	size_t back = tail.load(memory_order_relaxed); // Only this thread moves tail
+	size_t front = head.load(memory_order_acquire);
+
+	while (back - front == ring.size())
+	{
+		head.wait(front, memory_order_acquire); // Sleeps until head changes
+		front = head.load(memory_order_acquire);
+	}
+
+	ring[back % ring.size()] = slot;
+	tail.store(back + 1, memory_order_release);
+	tail.notify_one();
+}
+
+size_t SlotQueue::pop()
+{
+	/* [Public Method]
+	* Takes the slot at the front of the queue. If the queue is empty, sleeps until the producer pushes one.
+	*/
+
+	size_t front = head.load(memory_order_relaxed); // Only this thread moves head
+	size_t back = tail.load(memory_order_acquire);
+
+	while (back == front)
+	{
+		tail.wait(back, memory_order_acquire);
+		back = tail.load(memory_order_acquire);
+	}
+
+	size_t slot = ring[front % ring.size()];
+	head.store(front + 1, memory_order_release);
+	head.notify_one();
+
+	return slot;
+}
+
+Pipeline::Pipeline(size_t slots, bool threaded) // Constructor
+{
+	this->slots = slots;
+	this->threaded = threaded;
+}
+
+bool Pipeline::run(function<bool(size_t)> read, function<bool(size_t)> code, function<void(size_t)> write)
+{
+	/* [Public Method]
+	* Calls read, code and write on slot after slot until read returns false (nothing left to read).
+	* Slots are always coded and written in the order they were read, and a slot is only read into again
+	* once it has been written, so each stage has the slot's buffers to itself.
+	*
+	* read runs on a reader thread, code on the calling thread and write on a writer thread, so reading
+	* slot 3 while slot 2 is coded and slot 1 is written. Without threads, each slot goes through all three
+	* in turn.
+	*
+	* If code returns false, nothing from that slot on is written and reading stops as soon as the reader
+	* checks in. Returns false in that case, once both threads have finished, otherwise true.
+	*/
+
+	if (!threaded)
+	{
+		for (size_t slot = 0; ; slot = (slot + 1) % slots)
+		{
+			if (!read(slot)) return true;
+			if (!code(slot)) return false;
+			write(slot);
+		}
+	}
+
+	SlotQueue freeSlots(slots); // writer -> reader
+	SlotQueue filled(slots + 1); // reader -> coder, with room for END
+	SlotQueue coded(slots + 1); // coder -> writer
+
+	vector<char> failed(slots, 0); // Set by the coder for slots the writer should skip
+	atomic<bool> stopping(false);
+
+	for (size_t slot = 0; slot < slots; slot++) freeSlots.push(slot);
+
+	thread reader([&]()
+	{
+		while (true)
+		{
+			size_t slot = freeSlots.pop();
+
+			if (stopping || !read(slot))
+			{
+				filled.push(END);
+				return;
+			}
+
+			filled.push(slot);
+		}
+	});
+
+	thread writer([&]()
+	{
+		while (true)
+		{
+			size_t slot = coded.pop();
+			if (slot == END) return;
+
+			if (!failed[slot]) write(slot);
+			freeSlots.push(slot);
+		}
+	});
+
+	while (true)
+	{
+		size_t slot = filled.pop();
+		if (slot == END) break;
+
+		failed[slot] = stopping || !code(slot); // Once one slot fails, the rest are just handed back
+		if (failed[slot]) stopping = true;
+
+		coded.push(slot);
+	}
+
+	coded.push(END);
+
+	reader.join();
+	writer.join();
+
+	return !stopping;
+}
+
+size_t Pipeline::size()
+{
+	return slots;
+}
@@ -0,0 +1,50 @@
+/*
+Pipeline.h
+
+The header for Pipeline.cpp
+
+*/
+
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <cstdint>
+#pragma once
+
+using namespace std;
+
+class SlotQueue // Bounded queue of slot numbers between one producer thread and one consumer thread
+{
+public:
+
+	SlotQueue(size_t capacity); // Holds up to capacity slot numbers
+
+	void push(size_t slot); // Adds slot at the back, waiting while the queue is full
+	size_t pop(); // Takes the slot at the front, waiting while the queue is empty
+
+private:
+
+	vector<size_t> ring;
+	atomic<size_t> head; // Slots popped so far, only the consumer moves it
+	atomic<size_t> tail; // Slots pushed so far, only the producer moves it
+
+};
+
+class Pipeline
+{
+public:
+
+	Pipeline(size_t slots, bool threaded = true); // Moves slots buffers through the stages, on their own threads if threaded
+
+	bool run(function<bool(size_t)> read, function<bool(size_t)> code, function<void(size_t)> write); // Runs every buffer through read, code and write, in order
+	size_t size(); // Number of slots
+
+private:
+
+	static const size_t END = SIZE_MAX; // Passed down the queues once read runs out
+
+	size_t slots;
+	bool threaded;
+
+};
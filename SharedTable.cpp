@@ -0,0 +1,375 @@
+/*
+SharedTable.cpp
+
+A code table trained once over a corpus (see Huffman::makeSharedTable) and shared by every record encoded
+with it, for data like small JSON records where a length table in every output would cost more than it saves.
+
+load compiles the table's canonical codes and decode tables once, and every encode and decode after that
+just uses them. Neither one changes the object, so a loaded table can be shared between threads.
+
+Each record is:
+
+	"HS"
+	table ID (4 bytes, little endian)
+	raw length (4 bytes, little endian)
+	the encoded bits, padded to a whole byte
+
+For small messages (like RPCs) where even that header is too much, encodeMessage writes only the bits,
+padded out to a whole byte with 1s, and decodeMessage finds the end of the message from the padding alone.
+Every byte has a code, so the longest code is at least 8 bits, and with canonical codes the longest one
+is all 1s (it is the last code, and the codes fill the whole code space). So 7 or fewer 1s can never be a
+whole code, and a decoder left with only that many 1s knows it has reached the padding.
+
+*/
+
+#include "SharedTable.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <iomanip>
+#include <iterator>
+#include <algorithm>
+
+SharedTable::SharedTable() // Constructor
+{
+	tableId = 0;
+	loaded = false;
+	longestCode = 0;
+}
+
+bool SharedTable::load(string tableFile)
+{
+	/* [Public Method]
+	* Reads tableFile ("HT", version 1, the table ID, then a length table) and compiles it into the
+	* encoder's cipher arrays and the decoder's lookup tables. Every byte must have a code, since the
+	* table has to encode records it never saw. Returns false if the file can't be read or isn't a table.
+	*/
+
+	loaded = false;
+
+	ifstream input(tableFile, ios::binary);
+	vector<unsigned char> file((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+
+	if (file.size() < 7 || file[0] != 'H' || file[1] != 'T' || file[2] != 1) return false;
+
+	tableId = 0;
+	for (int i = 0; i < 4; i++) tableId |= (unsigned int)file[3 + i] << (8 * i);
+
+	if (coder.readLengthTable(file.data() + 7, file.size() - 7) < 0) return false;
+
+	for (int i = 0; i < 256; i++)
+	{
+		if (coder.codeLengths[i] == 0 || coder.codeLengths[i] > BLOCK_MAX_CODE_LENGTH) return false;
+	}
+
+	coder.compileDecoderFromLengths(); // Also assigns the canonical codes the encoder uses
+
+	longestCode = *max_element(coder.codeLengths, coder.codeLengths + 256);
+
+	loaded = true;
+	return true;
+}
+
+unsigned int SharedTable::id()
+{
+	return tableId;
+}
+
+HuffmanStatus SharedTable::encode(span<const unsigned char> input, vector<unsigned char>& output)
+{
+	/* [Public Method]
+	* Encodes input as one record, replacing output's contents. The exact size is counted first so output
+	* is only resized once. Returns HUFFMAN_UNSUPPORTED if no table is loaded.
+	*/
+
+	output.clear();
+	if (!loaded) return HUFFMAN_UNSUPPORTED;
+
+	unsigned long long bits = 0;
+	for (size_t i = 0; i < input.size(); i++) bits += coder.cipherLength[input[i]];
+
+	output.resize(SHARED_RECORD_HEADER_SIZE + (bits + 7) / 8);
+
+	output[0] = 'H';
+	output[1] = 'S';
+	for (int i = 0; i < 4; i++) output[2 + i] = (unsigned char)(tableId >> (8 * i));
+	for (int i = 0; i < 4; i++) output[6 + i] = (unsigned char)(input.size() >> (8 * i));
+
+	BitWriter writer;
+	writer.out = output.data() + SHARED_RECORD_HEADER_SIZE;
+
+	for (size_t i = 0; i < input.size(); i++) writer.put(coder.cipherCode[input[i]], coder.cipherLength[input[i]]);
+
+	writer.finish();
+
+	return HUFFMAN_OK;
+}
+
+HuffmanStatus SharedTable::decode(span<const unsigned char> input, vector<unsigned char>& output)
+{
+	/* [Public Method]
+	* Decodes a record made by encode, replacing output's contents. Returns HUFFMAN_UNSUPPORTED if it isn't
+	* a record or was made with a different table, or HUFFMAN_CORRUPT if it is damaged. output is cleared on error.
+	*/
+
+	output.clear();
+
+	if (!loaded || input.size() < SHARED_RECORD_HEADER_SIZE || input[0] != 'H' || input[1] != 'S') return HUFFMAN_UNSUPPORTED;
+
+	unsigned int recordId = 0;
+	size_t rawLength = 0;
+	for (int i = 0; i < 4; i++) recordId |= (unsigned int)input[2 + i] << (8 * i);
+	for (int i = 0; i < 4; i++) rawLength |= (size_t)input[6 + i] << (8 * i);
+
+	if (recordId != tableId) return HUFFMAN_UNSUPPORTED;
+	if (rawLength > (input.size() - SHARED_RECORD_HEADER_SIZE) * 8) return HUFFMAN_CORRUPT; // Every code is at least 1 bit
+
+	output.resize(rawLength);
+
+	BitReader reader;
+	reader.in = input.data() + SHARED_RECORD_HEADER_SIZE;
+	reader.end = input.data() + input.size();
+
+	if (!coder.decodeBits(reader, output.data(), rawLength))
+	{
+		output.clear();
+		return HUFFMAN_CORRUPT;
+	}
+
+	return HUFFMAN_OK;
+}
+
+HuffmanStatus SharedTable::encodeMessage(span<const unsigned char> input, span<unsigned char> output, size_t& written)
+{
+	/* [Public Method]
+	* Encodes input into output as nothing but its codes, padded to a whole byte with 1s, and sets written to
+	* the number of bytes used. Nothing is allocated, so this is cheap enough to run on every request.
+	*
+	* If output holds maxMessageSize(input.size()) bytes it is always big enough. Otherwise the exact size
+	* is counted first, and HUFFMAN_NO_SPACE is returned (with nothing written) if it doesn't fit. Returns
+	* HUFFMAN_UNSUPPORTED if no table is loaded.
+	*/
+
+	written = 0;
+	if (!loaded) return HUFFMAN_UNSUPPORTED;
+
+	if (output.size() < maxMessageSize(input.size())) // Might not fit, count exactly
+	{
+		unsigned long long bits = 0;
+		for (size_t i = 0; i < input.size(); i++) bits += coder.cipherLength[input[i]];
+		if ((bits + 7) / 8 > output.size()) return HUFFMAN_NO_SPACE;
+	}
+
+	BitWriter writer;
+	writer.out = output.data();
+
+	for (size_t i = 0; i < input.size(); i++) writer.put(coder.cipherCode[input[i]], coder.cipherLength[input[i]]);
+
+	int padding = (8 - writer.count % 8) % 8;
+	writer.put((1u << padding) - 1, padding); // Pads with 1s, which decodeMessage can tell apart from a code
+
+	writer.finish();
+	written = writer.out - output.data();
+
+	return HUFFMAN_OK;
+}
+
+HuffmanStatus SharedTable::decodeMessage(span<const unsigned char> input, span<unsigned char> output, size_t& written)
+{
+	/* [Public Method]
+	* Decodes a message made by encodeMessage into output, and sets written to the number of bytes decoded.
+	* Nothing is allocated.
+	*
+	* Codes are at most BLOCK_MAX_CODE_LENGTH bits, so while the bit buffer holds that many, the next code is
+	* always entirely inside it. Once every bit has been loaded, codes are decoded until all that is left is
+	* the padding: fewer than 8 bits, all 1s. Any other leftover (a code cut off by the end, or padding with a
+	* 0 in it) returns HUFFMAN_CORRUPT.
+	*
+	* Returns HUFFMAN_NO_SPACE if output fills up before the message ends, or HUFFMAN_UNSUPPORTED if no table
+	* is loaded.
+	*/
+
+	written = 0;
+	if (!loaded) return HUFFMAN_UNSUPPORTED;
+
+	const Huffman::DecodeEntry* table = coder.decodeTable;
+
+	BitReader reader;
+	reader.in = input.data();
+	reader.end = input.data() + input.size();
+
+	size_t outIndex = 0;
+
+	while (true) // Every code here is whole in the buffer
+	{
+		reader.refill();
+		bool endOfInput = reader.in == reader.end;
+
+		while (reader.count >= BLOCK_MAX_CODE_LENGTH)
+		{
+			if (outIndex == output.size()) return HUFFMAN_NO_SPACE;
+
+			const Huffman::DecodeEntry& entry = table[reader.buffer >> (64 - DECODE_BITS)];
+
+			if (entry.length != 0)
+			{
+				output[outIndex++] = (unsigned char)entry.symbol;
+				reader.buffer <<= entry.length;
+				reader.count -= entry.length;
+				continue;
+			}
+
+			reader.buffer <<= DECODE_BITS; // Code is longer than DECODE_BITS, walk the rest of it bit-by-bit
+			reader.count -= DECODE_BITS;
+
+			int node = entry.symbol;
+			while (node >= 0)
+			{
+				node = coder.decodeNodes[node][reader.buffer >> 63];
+				reader.buffer <<= 1;
+				reader.count--;
+			}
+
+			output[outIndex++] = (unsigned char)~node;
+		}
+
+		if (endOfInput) break;
+	}
+
+	while (reader.count > 0) // The last bits, which end with the padding
+	{
+		if (reader.count < 8 && reader.buffer >> (64 - reader.count) == (1ULL << reader.count) - 1) break; // Only padding left
+
+		const Huffman::DecodeEntry& entry = table[reader.buffer >> (64 - DECODE_BITS)]; // The 0s past the end pad out the lookup
+		int symbol;
+
+		if (entry.length != 0)
+		{
+			if (entry.length > reader.count) return HUFFMAN_CORRUPT;
+
+			symbol = entry.symbol;
+			reader.buffer <<= entry.length;
+			reader.count -= entry.length;
+		}
+		else
+		{
+			if (reader.count < DECODE_BITS) return HUFFMAN_CORRUPT;
+
+			reader.buffer <<= DECODE_BITS;
+			reader.count -= DECODE_BITS;
+
+			int node = entry.symbol;
+			while (node >= 0)
+			{
+				if (reader.count == 0) return HUFFMAN_CORRUPT;
+				node = coder.decodeNodes[node][reader.buffer >> 63];
+				reader.buffer <<= 1;
+				reader.count--;
+			}
+
+			symbol = (unsigned char)~node;
+		}
+
+		if (outIndex == output.size()) return HUFFMAN_NO_SPACE;
+		output[outIndex++] = (unsigned char)symbol;
+	}
+
+	written = outIndex;
+	return HUFFMAN_OK;
+}
+
+size_t SharedTable::maxMessageSize(size_t length)
+{
+	/* [Public Method]
+	* Size of a buffer that always holds the message encodeMessage makes from length bytes.
+	*/
+
+	return (length * longestCode + 7) / 8;
+}
+
+HuffmanStatus SharedTable::encodeFile(string inputFile, string outputFile)
+{
+	/* [Public Method]
+	* Encodes all of inputFile as one record. If outputFile is omitted, it is inputFile with a .huf extension.
+	* Returns HUFFMAN_NO_FILE if inputFile can't be opened, otherwise HUFFMAN_OK.
+	*/
+
+	if (outputFile == "") // If outputFile is not specified, set its name to the input file w/ extension .huf
+	{
+		size_t last = inputFile.find_last_of('.');
+		outputFile = inputFile.substr(0, last);
+		outputFile += ".huf";
+	}
+	else if (outputFile.find('.') == string::npos) // This happens when the user specifies a file name but not an extension
+	{
+		outputFile += ".huf";
+	}
+
+	auto start = std::chrono::steady_clock::now(); // Used to get total elapsed time
+
+	ifstream input(inputFile, ios::binary);
+
+	if (!input.is_open())
+	{
+		cout << "Unable to open file: " << inputFile << endl; // File does not exist, so alert the user
+		return HUFFMAN_NO_FILE;
+	}
+
+	vector<unsigned char> raw((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+	vector<unsigned char> record;
+	encode(raw, record);
+
+	ofstream output(outputFile, ios::binary);
+	output.write((char*)record.data(), record.size());
+	output.close();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	cout << fixed << setprecision(3) << seconds << " seconds. " << raw.size() << " bytes in / " << record.size() << " bytes out" << endl;
+
+	return HUFFMAN_OK;
+}
+
+HuffmanStatus SharedTable::decodeFile(string inputFile, string outputFile)
+{
+	/* [Public Method]
+	* Decodes a file made by encodeFile into outputFile.
+	*
+	* Returns HUFFMAN_NO_FILE if inputFile can't be opened, HUFFMAN_UNSUPPORTED if it was encoded with another
+	* table, or HUFFMAN_CORRUPT if its record is damaged. outputFile is only written once the record has
+	* decoded, so nothing is left behind on an error. Otherwise returns HUFFMAN_OK.
+	*/
+
+	auto start = std::chrono::steady_clock::now(); // Used to get total elapsed time
+
+	ifstream input(inputFile, ios::binary);
+
+	if (!input.is_open())
+	{
+		cout << "Unable to open file: " << inputFile << endl;
+		return HUFFMAN_NO_FILE;
+	}
+
+	vector<unsigned char> record((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+	vector<unsigned char> raw;
+	HuffmanStatus status = decode(record, raw);
+
+	if (status == HUFFMAN_UNSUPPORTED)
+	{
+		cout << "File was not encoded with this table: " << inputFile << endl;
+		return status;
+	}
+	if (status == HUFFMAN_CORRUPT)
+	{
+		cout << "Corrupt block in file" << endl;
+		return status;
+	}
+
+	ofstream output(outputFile, ios::binary);
+	output.write((char*)raw.data(), raw.size());
+	output.close();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	cout << fixed << setprecision(3) << seconds << " seconds. " << record.size() << " bytes in / " << raw.size() << " bytes out" << endl;
+
+	return HUFFMAN_OK;
+}
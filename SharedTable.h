@@ -0,0 +1,42 @@
+/*
+SharedTable.h
+
+The header for SharedTable.cpp
+
+*/
+
+#include "Huffman.h"
+#include <string>
+#include <vector>
+#include <span>
+#pragma once
+
+#define SHARED_RECORD_HEADER_SIZE 10 // "HS", table ID, raw length
+
+using namespace std;
+
+class SharedTable
+{
+public:
+
+	SharedTable(); // Constructor
+
+	bool load(string tableFile); // Reads a table made by Huffman::makeSharedTable and compiles it, returns false if it can't
+	unsigned int id(); // ID of the loaded table, written into every record it encodes
+
+	HuffmanStatus encode(span<const unsigned char> input, vector<unsigned char>& output); // Encodes a buffer as one record that refers to the table
+	HuffmanStatus decode(span<const unsigned char> input, vector<unsigned char>& output); // Decodes a record made by encode with the same table
+	HuffmanStatus encodeMessage(span<const unsigned char> input, span<unsigned char> output, size_t& written); // Encodes a buffer as just its bits, into the caller's buffer
+	HuffmanStatus decodeMessage(span<const unsigned char> input, span<unsigned char> output, size_t& written); // Decodes a message made by encodeMessage, finding its end from the padding
+	size_t maxMessageSize(size_t length); // Most bytes encodeMessage can write for length bytes
+	HuffmanStatus encodeFile(string inputFile, string outputFile = ""); // Encodes a whole file as one record
+	HuffmanStatus decodeFile(string inputFile, string outputFile); // Decodes a file made by encodeFile
+
+private:
+
+	Huffman coder; // Holds the compiled codes and decode tables. Nothing else uses it, so they are never rebuilt
+	unsigned int tableId; // ID read from the table file
+	bool loaded; // Whether load succeeded
+	int longestCode; // Longest code in the table, for sizing messages
+
+};
@@ -22,21 +22,69 @@ Show help:
 Encode Directly from Input File
 
 	Syntax:
-	HUFF -e file1 [file2]
+	HUFF -e [-l n] [-b n] [-j n] [-s n] [-c n] [--stride n] [--stats=json] file1 [file2]
 
 	Uses: Encode file1 and place its output to file2. If the user omits file2, then simply encode file1 directly and append .huf to it
+
+	Options:
+	-l n	Limit codes to at most n bits (8-32). A limit of 11 or less keeps every code inside a single decode table lookup.
+	-b n	Encode the file in blocks of n KB (1-1048576, default 1024), each with its own codes.
+	-j n	Encode blocks on n threads at once (1-1024, default 1).
+	-s n	Split each block into n interleaved streams (1 or 4, default 1), so one thread can decode four at once.
+	-c n	Code each byte with one of n tables (2-16), picked by the byte before it. Used for blocks where it comes out smaller.
+	--stride n	Build each block's codes from a sample of 1 in every n runs of 64 bytes instead of counting
+			every byte. Faster, but usually a little bigger (BENCH file shows by how much). Can't be used with -c.
+	--stats=json	Print the summary as one line of JSON: bytes in/out, time spent in each phase, the longest
+			code, the entropy of the input and peak memory.
+
+	Values outside the range an option takes are refused (exit status 1).
+
+	If file1 is -, reads from stdin and writes the encoded file to stdout, one block at a time.
+
+	Batch:
+
+	Syntax: HUFF -e [options] --batch listfile
+		HUFF -e [options] directory
+
+	Uses: Encodes every file named in listfile (one per line), or every file under directory, in one process,
+	each to its name with .huf added. The files are shared out between -j n threads (default every core),
+	biggest first, and one summary is printed for the whole batch.
 	
 Decode file:
 	
-	Syntax: HUFF -d file1 file2
+	Syntax: HUFF -d [-j n] [--range offset:length] [--stats=json] file1 file2
 
 	Uses: Decodes a file1 and places its contents into file2.
 
+	Options:
+	-j n	Decode blocks on n threads at once (default 1), using the seek index at the end of file1.
+	--range offset:length	Decode only length bytes starting at offset (a negative offset counts back from the end,
+			and leaving out length decodes to the end). Only the blocks holding the range are decoded, found
+			through the seek index. If file2 is -, the bytes are written to stdout.
+	--stats=json	Print the summary as one line of JSON, as with -e.
+
+	If file1 is -, reads a block file from stdin and writes the decoded bytes to stdout, one block at a time.
+	With --stats=json in either stream mode, the JSON is printed to stderr.
+
+	HUFF -d [options] --batch listfile and HUFF -d [options] directory decode a batch the same way, each file
+	to its name with .huf taken off. From a directory, only files ending in .huf are decoded.
+
+Estimate the encoded size:
+
+	Syntax: HUFF -estimate [-l n] [-b n] [-j n] [-s n] [-c n] [--stride n] [--stats=json] file1
+
+	Uses: Works out what HUFF -e with the same options would make of file1, without writing anything: the exact
+	encoded size, the entropy of file1, how many blocks would be stored as they are, and how big the decoder's
+	tables would be. Only counts the bytes and builds each block's codes, so it takes a fraction of the time an
+	encode does. With --stride n, the counts come from a sample, and the size is an estimate. -c isn't taken
+	into account, so with it the size is marked as only the most the file could come to.
+
 Create a tree-building file:
 
-	Syntax: HUFF -t file1 [file2]
+	Syntax: HUFF -t [-j n] file1 [file2]
 
 	Uses: Reads file1 and builds a 510-byte tree building file. If file2 is omitted, then then create a file with file1's name using the .htree extension.
+	With -j n, the bytes are counted on n threads at once (default 1).
 
 Encoding with a specified tree-builder:
 
@@ -44,19 +92,50 @@ Encoding with a specified tree-builder:
 
 	Uses: Reads input from file1 and encodes it based on the 510-byte tree-builder file file2. The output will be file3. If omitted, create a new file with file1's name but with the .huf extension.
 
+Train a shared table:
+
+	Syntax: HUFF -train [-j n] [--sample n] [--batch listfile] tablefile [file1 | directory]
+
+	Uses: Counts the bytes of every file named in listfile, every file under directory, and/or file1 together, and
+	saves one code table trained on all of them to tablefile. With --sample n, only n of the files (spread evenly
+	through the list) are counted. With -j n, each file is counted on n threads at once (default 1).
+
+Encoding/decoding with a shared table:
+
+	Syntax: HUFF -es file1 tablefile [file2]
+		HUFF -ds file1 tablefile file2
+
+	Uses: Encodes file1 with the codes in tablefile, into a record that only names the table by its ID instead of
+	holding a table of its own. -ds decodes it back, and refuses records made with a different table.
+
 ==========================================
 
 */
 
 #include <iostream>
 #include<string>
+#include <fstream>
+#include <vector>
+#include <filesystem>
+#include <thread>
+#include <climits>
+#include <cerrno>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 #include "HNode.h"
 #include "Huffman.h"
+#include "SharedTable.h"
 
 using namespace std;
 
 void helpMode();
+vector<string> batchFiles(string listFile, string directory, bool decoding);
+long long optionValue(string option, const char* text, long long low, long long high); // Reads an option's number, exits if it is out of range
 
 int main(int argc, char* argv[]) 
 {
@@ -69,9 +148,74 @@ int main(int argc, char* argv[])
 
 	int fileIndex = 0; // used to keep track of which string in argv[] begins
 
-	files[0] = argv[2]; // Prime the loop
+	int argIndex = 2; // Options go between the mode and the file names
 
-	for (int i = 3; i < argc; i++) // Connects file names with spaces in them together
+	string batchList = ""; // List of files to code in one go, from --batch
+	bool threadsGiven = false;
+	bool strided = false; // --stride above 1 was given...
+	bool contextual = false; // ... and -c above 1, which can't be used together
+	size_t sampleFiles = 0; // Number of files -train samples from the corpus, 0 for all of them
+	HuffmanStatus status = HUFFMAN_OK; // Whether the files were coded, for the exit status
+	string range = ""; // offset:length to decode, from --range
+
+	while (argIndex < argc - 1 && argv[argIndex][0] == '-')
+	{
+		string option = argv[argIndex];
+
+		if (option == "--stats=json") // --stats=json: print the summary as JSON, takes no value
+		{
+			htree->setStatsJson(true);
+			argIndex += 1;
+			continue;
+		}
+
+		const char* value = argv[argIndex + 1];
+
+		if (option == "-l") htree->setMaxCodeLength((int)optionValue(option, value, 8, BLOCK_MAX_CODE_LENGTH)); // -l n: limit codes to n bits
+		else if (option == "-b") htree->setBlockSize((size_t)optionValue(option, value, MIN_BLOCK_SIZE / 1024, MAX_BLOCK_SIZE / 1024) * 1024); // -b n: n KB blocks
+		else if (option == "-j") // -j n: encode on n threads
+		{
+			htree->setThreads((int)optionValue(option, value, 1, 1024));
+			threadsGiven = true;
+		}
+		else if (option == "--batch") batchList = value; // --batch listfile: code every file named in listfile
+		else if (option == "--sample") sampleFiles = (size_t)optionValue(option, value, 0, LLONG_MAX); // --sample n: train on n of the files
+		else if (option == "-s") // -s n: n interleaved streams per block
+		{
+			int streams = (int)optionValue(option, value, 1, BLOCK_STREAMS);
+			if (streams != 1 && streams != BLOCK_STREAMS)
+			{
+				cout << "-s takes 1 or " << BLOCK_STREAMS << ", not " << value << endl;
+				exit(1);
+			}
+			htree->setStreams(streams);
+		}
+		else if (option == "-c") // -c n: order-1 contexts grouped into n tables
+		{
+			htree->setContextTables((int)optionValue(option, value, 2, CONTEXT_MAX_TABLES));
+			contextual = true;
+		}
+		else if (option == "--stride") // --stride n: count 1 in n runs of each block
+		{
+			long long stride = optionValue(option, value, 1, INT_MAX);
+			htree->setHistogramStride((size_t)stride);
+			strided = stride > 1;
+		}
+		else if (option == "--range") range = value; // --range offset:length: decode only those bytes
+		else break;
+
+		argIndex += 2;
+	}
+
+	if (strided && contextual) // -c counts every pair of bytes, so sampling wouldn't make it any faster
+	{
+		cout << "--stride can't be used with -c" << endl;
+		exit(1);
+	}
+
+	if (argIndex < argc) files[0] = argv[argIndex]; // Prime the loop (a batch may have no file names)
+
+	for (int i = argIndex + 1; i < argc; i++) // Connects file names with spaces in them together
 	{
 		if (files[fileIndex].find('.') == string::npos) files[fileIndex] = files[fileIndex] + " " + (string)argv[i]; // if files[fileIndex] still doesn't have an extension, keep building
 		else
@@ -82,26 +226,159 @@ int main(int argc, char* argv[])
 		}
 	}
 
-	if ((string)argv[1] == "-e") htree->encodeFile(files[0], files[1]); // encodes files[0]
+	bool directory = files[0] != "" && filesystem::is_directory(files[0]);
+
+	if ((string)argv[1] == "-train") // Trains a shared table, files[0], over the corpus in files[1] and/or the batch list
+	{
+		bool corpusDirectory = files[1] != "" && filesystem::is_directory(files[1]);
+		vector<string> inputFiles = batchFiles(batchList, corpusDirectory ? files[1] : "", false);
+		if (files[1] != "" && !corpusDirectory) inputFiles.push_back(files[1]);
+
+		htree->makeSharedTable(inputFiles, files[0], sampleFiles);
+	}
+
+	else if ((string)argv[1] == "-es" || (string)argv[1] == "-ds") // Encodes or decodes files[0] with the shared table files[1]
+	{
+		SharedTable* table = new SharedTable();
+
+		if (!table->load(files[1]))
+		{
+			cout << "Unable to load table: " << files[1] << endl;
+			exit(1);
+		}
+
+		if ((string)argv[1] == "-es") status = table->encodeFile(files[0], files[2]);
+		else if (files[2] != "") status = table->decodeFile(files[0], files[2]);
+
+		delete table;
+	}
+
+	else if ((batchList != "" || directory) && ((string)argv[1] == "-e" || (string)argv[1] == "-d")) // Batch mode: many files in one process
+	{
+		bool decoding = (string)argv[1] == "-d";
+		if (!threadsGiven) htree->setThreads(max(1, (int)thread::hardware_concurrency())); // Batches use every core unless told otherwise
+
+		vector<string> inputFiles = batchFiles(batchList, directory ? files[0] : "", decoding);
+
+		if (decoding) status = htree->decodeFiles(inputFiles);
+		else status = htree->encodeFiles(inputFiles);
+	}
+
+	else if (files[0] == "-" && ((string)argv[1] == "-e" || (string)argv[1] == "-d")) // Stream mode: read stdin, write stdout
+	{
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY); // Keep the console streams from translating newlines
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		ios::sync_with_stdio(false); // Nothing else is printed to stdout, so cin/cout can skip syncing with stdio for speed
+
+		if ((string)argv[1] == "-e") htree->encodeStream(cin, cout);
+		else status = htree->decodeStream(cin, cout);
+	}
+
+	else if ((string)argv[1] == "-e") status = htree->encodeFile(files[0], files[1]); // encodes files[0]
 
 	else if ((string)argv[1] == "-t") htree->makeTreeBuilder(files[0], files[1]); // makes a tree builder file for files[1]
 
-	else if ((string)argv[1] == "-d" && files[1] != "") htree->decodeFile(files[0], files[1]); // decodes files[0] if an output file is specified
+	else if ((string)argv[1] == "-estimate") status = htree->estimateFile(files[0]).status; // works out what encoding files[0] would come to
+
+	else if ((string)argv[1] == "-d" && files[1] != "" && range != "") // decodes only part of files[0]
+	{
+		size_t colon = range.find(':');
+		long long offset = atoll(range.substr(0, colon).c_str());
+		unsigned long long length = colon == string::npos || colon + 1 == range.size() ? ULLONG_MAX : strtoull(range.c_str() + colon + 1, nullptr, 10); // No length means to the end
+
+#ifdef _WIN32
+		if (files[1] == "-") _setmode(_fileno(stdout), _O_BINARY);
+#endif
+		status = htree->decodeRange(files[0], files[1], offset, length);
+	}
+
+	else if ((string)argv[1] == "-d" && files[1] != "") status = htree->decodeFile(files[0], files[1]); // decodes files[0] if an output file is specified
 
 	else if ((string)argv[1] == "-et") htree->encodeFileWithTree(files[0], files[1], files[2]); // encodes files[0] file with tree file files[1]
 
 	delete htree;
-	exit(0);
+	exit(status == HUFFMAN_OK ? 0 : 1);
+
+}
+
+long long optionValue(string option, const char* text, long long low, long long high)
+{
+	/*
+	* Reads the whole number text given to option. If text isn't one, or is outside low to high, says what
+	* option takes and exits with status 1, so a mistyped value never runs with a different one.
+	*/
+
+	char* end;
+	errno = 0;
+	long long value = strtoll(text, &end, 10);
+
+	if (end == text || *end != '\0' || errno == ERANGE || value < low || value > high)
+	{
+		cout << option << " takes a whole number from " << low << " to " << high << ", not " << text << endl;
+		exit(1);
+	}
+
+	return value;
+}
+
+vector<string> batchFiles(string listFile, string directory, bool decoding)
+{
+	/*
+	* Gathers the files for batch mode: every line of listFile, then every regular file under directory
+	* (and its subdirectories). From a directory, encoding skips files already ending in .huf, and decoding
+	* takes only those.
+	*/
+
+	vector<string> inputFiles;
+
+	if (listFile != "")
+	{
+		ifstream list(listFile);
+
+		if (!list.is_open())
+		{
+			cout << "Unable to open file: " << listFile << endl;
+			exit(0);
+		}
+
+		string line;
+		while (getline(list, line))
+		{
+			if (!line.empty() && line.back() == '\r') line.pop_back(); // Lists written on Windows
+			if (!line.empty()) inputFiles.push_back(line);
+		}
+	}
+
+	if (directory != "")
+	{
+		error_code error;
+		for (const filesystem::directory_entry& entry : filesystem::recursive_directory_iterator(directory, error))
+		{
+			if (!entry.is_regular_file()) continue;
+
+			string name = entry.path().string();
+			bool encoded = name.size() > 4 && name.compare(name.size() - 4, 4, ".huf") == 0;
+			if (encoded == decoding) inputFiles.push_back(name);
+		}
+	}
 
+	return inputFiles;
 }
 
 void helpMode()
 {
 	cout << "ARGUMENTS:" << endl;
 	cout << "HELP MODE: -h, -?, -help" << endl;
-	cout << "ENCODE FILE: -e file1 [file2]" << endl;
-	cout << "DECODE FILE: -d file1 [file2]" << endl;
-	cout << "CREATE TREE-BUILDING FILE: -t file1 [file2]" << endl;
+	cout << "ENCODE FILE: -e [-l maxCodeLength] [-b blockKB] [-j threads] [-s streams] [-c tables] [--stride n] [--stats=json] file1 [file2]" << endl;
+	cout << "DECODE FILE: -d [-j threads] [--range offset:length] [--stats=json] file1 [file2]" << endl;
+	cout << "ENCODE/DECODE STDIN TO STDOUT: -e [options] -, -d -" << endl;
+	cout << "ENCODE/DECODE MANY FILES: -e [options] --batch listfile, -e [options] directory, -d [options] --batch listfile, -d [options] directory" << endl;
+	cout << "ESTIMATE THE ENCODED SIZE: -estimate [-l maxCodeLength] [-b blockKB] [-j threads] [-s streams] [-c tables] [--stride n] [--stats=json] file1" << endl;
+	cout << "CREATE TREE-BUILDING FILE: -t [-j threads] file1 [file2]" << endl;
 	cout << "ENCODE WITH A SPECIFIED TREE-BUILDER: -et file1 file2 [file3]" << endl;
+	cout << "TRAIN A SHARED TABLE: -train [-j threads] [--sample n] [--batch listfile] tablefile [file1 | directory]" << endl;
+	cout << "ENCODE/DECODE WITH A SHARED TABLE: -es file1 tablefile [file2], -ds file1 tablefile file2" << endl;
 	return;
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+/*
+StaticCodec.h
+
+An encoder and decoder for one fixed tree, with its tables built at compile time.
+
+HGEN (HGen.cpp) turns a tree building file from -t into a header holding a constexpr StaticTable, and
+StaticCodec takes that table as a template parameter:
+
+	#include "textTable.h" // Made by: HGEN text.htree textTable.h textTable
+
+	vector<unsigned char> packed, unpacked;
+	StaticCodec<textTable>::encode(message, packed);
+	StaticCodec<textTable>::decode(packed, message.size(), unpacked);
+
+Nothing is read, built or allocated at run time besides the output, since the codes and decode tables
+sit in the program's read-only data. The bits are the same ones -et writes after its 510-byte header for
+the same tree, and nothing else is written, so the caller keeps track of how many bytes were encoded.
+
+Kept in a header, like BitIO.h, since the codec is a template.
+
+*/
+
+#include "Huffman.h"
+#include "BitIO.h"
+#include <vector>
+#include <span>
+#pragma once
+
+using namespace std;
+
+struct StaticDecodeEntry // Same as Huffman's DecodeEntry
+{
+	unsigned short symbol; // Decoded byte, or the nodes[] index to keep walking from if length is 0
+	unsigned char length; // Number of bits the code takes up. 0 means the code is longer than DECODE_BITS
+};
+
+struct StaticTable
+{
+	int maxLength; // Longest code in the table
+	unsigned long long codes[256][4]; // Each byte's code, left-aligned across the 4 words like Huffman::longCipher
+	unsigned char lengths[256]; // Length of each byte's code
+	StaticDecodeEntry decode[1 << DECODE_BITS]; // Resolves the next DECODE_BITS bits in one lookup, like Huffman::decodeTable
+	short nodes[255][2]; // The tree's internal nodes, like Huffman::decodeNodes. Children < 0 are leaves holding ~key
+};
+
+template <const StaticTable& table>
+class StaticCodec
+{
+public:
+
+	static size_t encodedSize(span<const unsigned char> input) // Exact number of bytes encode writes for input
+	{
+		unsigned long long bits = 0;
+		for (size_t i = 0; i < input.size(); i++) bits += table.lengths[input[i]];
+		return (bits + 7) / 8;
+	}
+
+	static size_t encode(span<const unsigned char> input, unsigned char* output) // Encodes input into output, which must hold encodedSize(input) bytes. Returns the bytes written
+	{
+		BitWriter writer;
+		writer.out = output;
+
+		for (size_t i = 0; i < input.size(); i++)
+		{
+			int length = table.lengths[input[i]];
+
+			if constexpr (table.maxLength <= 32) writer.put((unsigned int)(table.codes[input[i]][0] >> (64 - length)), length); // Known when compiled, so the long code path is left out entirely
+			else if (length <= 32) writer.put((unsigned int)(table.codes[input[i]][0] >> (64 - length)), length);
+			else writer.putLong(table.codes[input[i]], length);
+		}
+
+		writer.finish();
+		return writer.out - output;
+	}
+
+	static void encode(span<const unsigned char> input, vector<unsigned char>& output) // Encodes input into output, replacing what it held
+	{
+		output.resize(encodedSize(input));
+		encode(input, output.data());
+	}
+
+	static HuffmanStatus decode(span<const unsigned char> input, unsigned char* output, size_t length) // Decodes length bytes from input into output
+	{
+		/*
+		* Each code is looked up DECODE_BITS bits at a time, and codes longer than that are walked a bit at
+		* a time through nodes[] from where the lookup left off. Returns HUFFMAN_CORRUPT if the bits run out
+		* before length bytes are decoded. Bytes left over in input after that are ignored.
+		*/
+
+		BitReader reader;
+		reader.in = input.data();
+		reader.end = input.data() + input.size();
+
+		size_t i = 0;
+
+		while (i < length)
+		{
+			reader.refill();
+
+			while (reader.count >= DECODE_BITS && i < length) // Codes that fit in the table, as many as the buffer holds
+			{
+				const StaticDecodeEntry& entry = table.decode[reader.buffer >> (64 - DECODE_BITS)];
+				if (entry.length == 0) break;
+
+				output[i++] = (unsigned char)entry.symbol;
+				reader.buffer <<= entry.length;
+				reader.count -= entry.length;
+			}
+
+			if (i == length) break;
+
+			const StaticDecodeEntry& entry = table.decode[reader.buffer >> (64 - DECODE_BITS)];
+
+			if (reader.count < DECODE_BITS) // Out of bits, or down to the last few (the 0s below them pad out the lookup)
+			{
+				if (reader.in != reader.end) continue;
+				if (entry.length == 0 || entry.length > reader.count) return HUFFMAN_CORRUPT;
+
+				output[i++] = (unsigned char)entry.symbol;
+				reader.buffer <<= entry.length;
+				reader.count -= entry.length;
+				continue;
+			}
+
+			reader.buffer <<= DECODE_BITS; // Code is longer than DECODE_BITS, walk the rest of it bit-by-bit
+			reader.count -= DECODE_BITS;
+
+			int node = entry.symbol;
+
+			while (node >= 0)
+			{
+				if (reader.count == 0)
+				{
+					reader.refill();
+					if (reader.count == 0) return HUFFMAN_CORRUPT;
+				}
+
+				node = table.nodes[node][reader.buffer >> 63];
+				reader.buffer <<= 1;
+				reader.count--;
+			}
+
+			output[i++] = (unsigned char)~node;
+		}
+
+		return HUFFMAN_OK;
+	}
+
+	static HuffmanStatus decode(span<const unsigned char> input, size_t length, vector<unsigned char>& output) // Decodes length bytes from input into output, replacing what it held. output is cleared on error
+	{
+		output.resize(length);
+
+		HuffmanStatus status = decode(input, output.data(), length);
+		if (status != HUFFMAN_OK) output.clear();
+
+		return status;
+	}
+};
@@ -0,0 +1,93 @@
+/*
+Stats.cpp
+
+Merging and reporting the counters in HuffmanStats.
+
+*/
+
+#include "Stats.h"
+#include <cmath>
+#include <iomanip>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+void HuffmanStats::add(const HuffmanStats& other)
+{
+	blocks += other.blocks;
+	histogramNs += other.histogramNs;
+	treeNs += other.treeNs;
+	tableNs += other.tableNs;
+	codingNs += other.codingNs;
+	ioNs += other.ioNs;
+	if (other.maxCodeLength > maxCodeLength) maxCodeLength = other.maxCodeLength;
+	for (int i = 0; i < 256; i++) byteCounts[i] += other.byteCounts[i];
+}
+
+double HuffmanStats::entropy() const
+{
+	unsigned long long total = 0;
+	for (int i = 0; i < 256; i++) total += byteCounts[i];
+	if (total == 0) return 0;
+
+	double bits = 0;
+	for (int i = 0; i < 256; i++)
+	{
+		if (byteCounts[i] == 0) continue;
+		double p = (double)byteCounts[i] / total;
+		bits -= p * log2(p);
+	}
+
+	return bits;
+}
+
+unsigned long long peakMemoryBytes()
+{
+#ifdef _WIN32
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss; // Already in bytes
+#else
+	return (unsigned long long)usage.ru_maxrss * 1024; // Kilobytes on Linux
+#endif
+#endif
+}
+
+void writeStatsJson(ostream& output, const HuffmanStats& stats, string mode, double seconds)
+{
+	/*
+	* Per-phase times are summed over every thread, so with -j they can add up to more than seconds.
+	* entropy is only known when encoding, and is written as null otherwise.
+	*/
+
+#ifndef HUFFMAN_NO_STATS
+	bool instrumented = true;
+#else
+	bool instrumented = false;
+#endif
+
+	bool encoding = mode != "decode";
+
+	output << "{\"mode\":\"" << mode << "\""
+		<< ",\"bytes_in\":" << stats.bytesIn
+		<< ",\"bytes_out\":" << stats.bytesOut
+		<< ",\"files\":" << stats.files
+		<< ",\"seconds\":" << fixed << setprecision(6) << seconds
+		<< ",\"instrumented\":" << (instrumented ? "true" : "false")
+		<< ",\"blocks\":" << stats.blocks
+		<< ",\"ns\":{\"histogram\":" << stats.histogramNs
+		<< ",\"tree\":" << stats.treeNs
+		<< ",\"table\":" << stats.tableNs
+		<< ",\"coding\":" << stats.codingNs
+		<< ",\"io\":" << stats.ioNs << "}"
+		<< ",\"max_code_length\":" << stats.maxCodeLength;
+
+	if (encoding && instrumented) output << ",\"entropy\":" << setprecision(4) << stats.entropy();
+	else output << ",\"entropy\":null";
+
+	output << ",\"peak_memory_bytes\":" << peakMemoryBytes() << "}" << endl;
+}
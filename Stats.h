@@ -0,0 +1,51 @@
+/*
+Stats.h
+
+Counters filled in while encoding and decoding, and the macros that fill them.
+
+The timing macros go in the hot paths, so they only take the time once per block (or buffer),
+never per byte. Building with HUFFMAN_NO_STATS defined turns every macro into nothing, leaving
+only the byte counts the console summary needs.
+
+*/
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#pragma once
+
+using namespace std;
+
+#ifndef HUFFMAN_NO_STATS
+#define STATS_START(timer) auto timer = std::chrono::steady_clock::now() // Starts a timer
+#define STATS_STOP(field, timer) stats.field += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - timer).count() // Adds the time since timer started to field
+#define STATS_ADD(field, amount) stats.field += (amount)
+#define STATS_MAX(field, value) if ((value) > stats.field) stats.field = (value)
+#else
+#define STATS_START(timer)
+#define STATS_STOP(field, timer)
+#define STATS_ADD(field, amount)
+#define STATS_MAX(field, value)
+#endif
+
+struct HuffmanStats
+{
+	unsigned long long bytesIn = 0; // Always counted, the console summary needs them
+	unsigned long long bytesOut = 0;
+	unsigned long long files = 1; // Files (or buffers) coded, more than 1 in batch mode
+
+	unsigned long long blocks = 0; // Blocks (or whole files, for the older formats) coded
+	unsigned long long histogramNs = 0; // Counting bytes
+	unsigned long long treeNs = 0; // Building or rebuilding the huffman tree
+	unsigned long long tableNs = 0; // Turning it into codes to encode with, or tables to decode with
+	unsigned long long codingNs = 0; // The encode or decode loop itself
+	unsigned long long ioNs = 0; // Waiting on reads and writes
+	int maxCodeLength = 0; // Longest code used
+	unsigned long long byteCounts[256] = {}; // Bytes encoded, for the entropy
+
+	void add(const HuffmanStats& other); // Adds another object's counters in (from a worker thread)
+	double entropy() const; // Shannon entropy of byteCounts[], in bits per byte
+};
+
+unsigned long long peakMemoryBytes(); // Most memory the process has held at once, 0 if unknown
+void writeStatsJson(ostream& output, const HuffmanStats& stats, string mode, double seconds); // Writes stats as one line of JSON
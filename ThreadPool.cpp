@@ -0,0 +1,114 @@
+/*
+ThreadPool.cpp
+
+A fixed set of worker threads that run queued tasks.
+
+Each task is handed the index of the worker running it, so callers can give every worker
+its own state (like a Huffman object) and reuse it from task to task.
+
+Tasks are dealt out round-robin, each worker getting its own queue so they don't all fight over one
+lock. A worker whose queue runs dry steals from the others, so a worker that drew a few long tasks
+doesn't hold everyone up while the rest sit idle.
+
+*/
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threads) // Constructor
+{
+	stopping = false;
+	nextQueue = 0;
+	pending = 0;
+	for (int i = 0; i < threads; i++) queues.push_back(make_unique<WorkerQueue>());
+	for (int i = 0; i < threads; i++) workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() // Destructor
+{
+	{
+		lock_guard<mutex> guard(sleepLock);
+		stopping = true;
+	}
+	tasksReady.notify_all();
+
+	for (thread& worker : workers) worker.join();
+}
+
+future<void> ThreadPool::submit(function<void(int)> task)
+{
+	/* [Public Method]
+	* Queues task on the next worker's queue. The returned future becomes ready once it has run.
+	* Tasks on the same queue run in the order they were submitted, unless another worker steals them first.
+	*/
+
+	packaged_task<void(int)> packaged(task);
+	future<void> done = packaged.get_future();
+
+	WorkerQueue& queue = *queues[nextQueue++ % queues.size()];
+
+	{
+		lock_guard<mutex> guard(queue.lock);
+		queue.tasks.push_back(move(packaged));
+	}
+
+	{
+		lock_guard<mutex> guard(sleepLock); // Counted under sleepLock, so a worker can't miss it between checking and sleeping
+		pending++;
+	}
+	tasksReady.notify_one();
+
+	return done;
+}
+
+int ThreadPool::size()
+{
+	return (int)workers.size();
+}
+
+bool ThreadPool::takeTask(int worker, packaged_task<void(int)>& task)
+{
+	/* [Private Method]
+	* Takes the oldest task from worker's own queue, or failing that, from the next worker along that has one.
+	* Returns false if every queue is empty.
+	*
+	* Stealing takes the oldest task too, so when tasks are submitted biggest first (like the batch mode's
+	* files), whatever is stolen is the biggest one left on that queue.
+	*/
+
+	for (size_t i = 0; i < queues.size(); i++)
+	{
+		WorkerQueue& queue = *queues[(worker + i) % queues.size()];
+		lock_guard<mutex> guard(queue.lock);
+		if (queue.tasks.empty()) continue;
+
+		task = move(queue.tasks.front());
+		queue.tasks.pop_front();
+		pending--;
+		return true;
+	}
+
+	return false;
+}
+
+void ThreadPool::workerLoop(int worker)
+{
+	/* [Private Method]
+	* Runs tasks for as long as any queue has them, then waits for more. Once the pool is stopping, the
+	* loop exits after every queue is empty.
+	*/
+
+	while (true)
+	{
+		packaged_task<void(int)> task;
+
+		if (takeTask(worker, task))
+		{
+			task(worker);
+			continue;
+		}
+
+		unique_lock<mutex> guard(sleepLock);
+		tasksReady.wait(guard, [this] { return stopping || pending > 0; });
+		if (stopping && pending == 0) return;
+	}
+}
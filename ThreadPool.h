@@ -0,0 +1,50 @@
+/*
+ThreadPool.h
+
+The header for ThreadPool.cpp
+
+*/
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#pragma once
+
+using namespace std;
+
+class ThreadPool
+{
+public:
+
+	ThreadPool(int threads); // Starts the worker threads
+	~ThreadPool(); // Finishes queued tasks, then joins the workers
+
+	future<void> submit(function<void(int)> task); // Queues a task. It is called with the index of the worker running it
+	int size(); // Number of worker threads
+
+private:
+
+	struct WorkerQueue // Tasks dealt to one worker. Other workers steal from it once their own run dry
+	{
+		deque<packaged_task<void(int)>> tasks;
+		mutex lock;
+	};
+
+	void workerLoop(int worker); // Runs tasks until the pool is destroyed
+	bool takeTask(int worker, packaged_task<void(int)>& task); // Pops worker's next task, or steals one
+
+	vector<thread> workers;
+	vector<unique_ptr<WorkerQueue>> queues; // One per worker
+	atomic<unsigned int> nextQueue; // Queue the next submitted task is dealt to
+	atomic<int> pending; // Tasks queued but not yet taken
+	mutex sleepLock; // Guards sleeping workers' checks of pending and stopping
+	condition_variable tasksReady;
+	bool stopping;
+
+};